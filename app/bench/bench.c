@@ -0,0 +1,73 @@
+// bench.c
+// Runs every benchmark section (or the ones named on the command line).
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+long long Bench_nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void Bench_report(const char *name, double ns_per_op, double samples_per_op)
+{
+    if (samples_per_op > 0.0)
+    {
+        printf("  %-40s %12.1f ns/op %14.0f samples/s\n",
+               name, ns_per_op, samples_per_op * 1e9 / ns_per_op);
+    }
+    else
+    {
+        printf("  %-40s %12.1f ns/op\n", name, ns_per_op);
+    }
+}
+
+uint32_t Bench_rand(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+// Section names; the usage comment in app/CMakeLists.txt lists them too.
+static const struct {
+    const char *name;
+    int (*run)(void);
+} sections[] = {
+    { "dip",     Bench_dip },
+    { "baseline", Bench_baseline },
+    { "decimator", Bench_decimator },
+    { "flicker", Bench_flicker },
+    { "sampler", Bench_sampler },
+    { "period",  Bench_period },
+    { "udp",     Bench_udpFormat },
+};
+
+#define NUM_SECTIONS ((int)(sizeof(sections) / sizeof(sections[0])))
+
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    for (int i = 0; i < NUM_SECTIONS; i++)
+    {
+        int selected = (argc < 2);
+        for (int a = 1; a < argc; a++)
+        {
+            if (!strcmp(argv[a], sections[i].name)) selected = 1;
+        }
+        if (!selected) continue;
+
+        printf("[%s]\n", sections[i].name);
+        if (sections[i].run() != 0)
+        {
+            printf("  FAILED\n");
+            failures++;
+        }
+        fflush(stdout);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+// bench.h
+// Microbenchmarks for the app modules' hot paths. Runs without hardware
+// (the light sensor is replaced by a synthetic source) so results can be
+// tracked release to release.
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+
+// Monotonic time in nanoseconds.
+long long Bench_nowNs(void);
+
+// Print one result line. `samples_per_op` may be 0 when the operation is
+// not sample-oriented (then no samples/s figure is shown).
+void Bench_report(const char *name, double ns_per_op, double samples_per_op);
+
+// Deterministic 24-bit pseudo-random numbers (an LCG), so the synthetic
+// inputs are the same release to release. Each section seeds its own state.
+uint32_t Bench_rand(uint32_t *state);
+
+// Benchmark sections; each returns 0 on success (non-zero on a failed
+// self-check).
+int Bench_dip(void);
+int Bench_baseline(void);
+int Bench_decimator(void);
+int Bench_flicker(void);
+int Bench_sampler(void);
+int Bench_period(void);
+int Bench_udpFormat(void);
+
+#endif
@@ -0,0 +1,67 @@
+// bench_baseline.c
+// Per-sample cost of each baseline estimator on a noisy 20 kHz signal
+// with occasional level changes.
+#include "bench.h"
+#include "baseline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define NUM_SAMPLES (1 << 20)
+#define BENCH_RATE_HZ 20000
+
+static uint32_t rand_state = 4242u;
+
+int Bench_baseline(void)
+{
+    uint16_t *x = malloc(sizeof(uint16_t) * NUM_SAMPLES);
+    if (!x)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    int level = 1860;
+    for (int i = 0; i < NUM_SAMPLES; i++)
+    {
+        if (i % 100000 == 0) level = 1000 + (int)(Bench_rand(&rand_state) % 2000);
+        x[i] = (uint16_t)(level + (int)(Bench_rand(&rand_state) % 64) - 32);
+    }
+
+    static const struct { const char *name; BaselineKind kind; double window_ms; } cases[] = {
+        { "ema",              BASELINE_EMA,     0.0 },
+        { "median 100 ms",    BASELINE_MEDIAN,  100.0 },
+        { "median 2000 ms",   BASELINE_MEDIAN,  2000.0 },
+        { "trimmed 100 ms",   BASELINE_TRIMMED, 100.0 },
+        { "trimmed 2000 ms",  BASELINE_TRIMMED, 2000.0 },
+    };
+
+    int failures = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        BaselineConfig cfg = Baseline_default();
+        cfg.kind      = cases[c].kind;
+        cfg.window_ms = cases[c].window_ms;
+        Baseline b;
+        if (!Baseline_init(&b, &cfg, BENCH_RATE_HZ))
+        {
+            failures++;
+            continue;
+        }
+
+        long long t0 = Bench_nowNs();
+        for (int i = 0; i < NUM_SAMPLES; i++)
+        {
+            Baseline_push(&b, x[i], false);
+        }
+        double ns = (double)(Bench_nowNs() - t0);
+
+        char name[64];
+        snprintf(name, sizeof(name), "Baseline_push %s", cases[c].name);
+        Bench_report(name, ns, NUM_SAMPLES);
+        Baseline_free(&b);
+    }
+
+    free(x);
+    return failures;
+}
@@ -0,0 +1,84 @@
+// bench_decimator.c
+// Per-sample cost of decimating a noisy 20 kHz signal down to 1 kHz, for
+// each filter. Self-check: a steady level must come out unchanged.
+#include "bench.h"
+#include "decimator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define NUM_SAMPLES (1 << 20)
+#define BENCH_RATE_HZ 20000
+#define BLOCK 20        // one tick's batch at 20 kHz
+
+static uint32_t rand_state = 777u;
+
+int Bench_decimator(void)
+{
+    uint16_t *x   = malloc(sizeof(uint16_t) * NUM_SAMPLES);
+    uint16_t *out = malloc(sizeof(uint16_t) * NUM_SAMPLES);
+    if (!x || !out)
+    {
+        fprintf(stderr, "out of memory\n");
+        free(x);
+        free(out);
+        return 1;
+    }
+    for (int i = 0; i < NUM_SAMPLES; i++)
+    {
+        x[i] = (uint16_t)(1860 + (int)(Bench_rand(&rand_state) % 64) - 32);
+    }
+
+    static const struct { const char *name; DecimatorKind kind; int order; int taps; } cases[] = {
+        { "none",           DECIMATOR_NONE, 3, 8 },
+        { "cic order 3",    DECIMATOR_CIC,  3, 8 },
+        { "fir 8 taps/ph",  DECIMATOR_FIR,  3, 8 },
+        { "fir 16 taps/ph", DECIMATOR_FIR,  3, 16 },
+    };
+
+    int failures = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        DecimatorConfig cfg = Decimator_default();
+        cfg.kind           = cases[c].kind;
+        cfg.cic_order      = cases[c].order;
+        cfg.taps_per_phase = cases[c].taps;
+        cfg.factor         = BENCH_RATE_HZ / DECIMATOR_AUTO_HZ;
+        Decimator d;
+        if (!Decimator_init(&d, &cfg, BENCH_RATE_HZ))
+        {
+            failures++;
+            continue;
+        }
+
+        int m = 0;
+        long long t0 = Bench_nowNs();
+        for (int i = 0; i < NUM_SAMPLES; i += BLOCK)
+        {
+            int n = NUM_SAMPLES - i < BLOCK ? NUM_SAMPLES - i : BLOCK;
+            m += Decimator_process(&d, x + i, n, out + m);
+        }
+        double ns = (double)(Bench_nowNs() - t0);
+
+        char name[64];
+        snprintf(name, sizeof(name), "Decimator_process %s", cases[c].name);
+        Bench_report(name, ns, NUM_SAMPLES);
+
+        // The noise is +-32 codes around 1860; filtered, it must stay close.
+        for (int j = 0; j < m; j++)
+        {
+            if (out[j] < 1860 - 32 || out[j] > 1860 + 32)
+            {
+                printf("  %s: output %d is %u, expected about 1860\n", cases[c].name, j, out[j]);
+                failures++;
+                break;
+            }
+        }
+        Decimator_free(&d);
+    }
+
+    free(x);
+    free(out);
+    return failures;
+}
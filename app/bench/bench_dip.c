@@ -0,0 +1,92 @@
+// bench_dip.c
+// Compare Dip_count() (SIMD block pre-pass) against Dip_countScalar()
+// on synthetic light waveforms.
+#include "bench.h"
+#include "dip_detector.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define NUM_SAMPLES (1 << 20)
+#define NUM_REPEATS 20
+#define BENCH_RATE_HZ 1000.0
+
+// Deterministic noise so runs are comparable release to release.
+static uint32_t rand_state = 12345u;
+static double noise(double amplitude)
+{
+    return amplitude * ((double)Bench_rand(&rand_state) / (double)(1u << 24) - 0.5);
+}
+
+// DC level with noise and a dip of `width` samples every `period` samples.
+static void make_wave(double *x, int n, int period, int width, double noise_v)
+{
+    for (int i = 0; i < n; i++)
+    {
+        double v = 1.5 + noise(noise_v);
+        if (period > 0 && (i % period) < width)
+        {
+            v -= 0.3;
+        }
+        x[i] = v;
+    }
+}
+
+typedef int (*count_fn)(const double *, int, double, const DipConfig *, double);
+
+static double time_fn(count_fn fn, const double *x, int n, const DipConfig *cfg, int *out)
+{
+    long long t0 = Bench_nowNs();
+    int d = 0;
+    for (int r = 0; r < NUM_REPEATS; r++)
+    {
+        d = fn(x, n, 1.5, cfg, BENCH_RATE_HZ);
+    }
+    *out = d;
+    return (double)(Bench_nowNs() - t0) / NUM_REPEATS;
+}
+
+int Bench_dip(void)
+{
+    static const struct { const char *name; int period; int width; double noise_v; } waves[] = {
+        { "quiet",         0,     0, 0.02 },
+        { "rare dips",     10000, 5, 0.02 },
+        { "frequent dips", 100,   5, 0.02 },
+        { "noisy",         1000,  5, 0.25 },
+    };
+
+    double *x = malloc(sizeof(double) * NUM_SAMPLES);
+    if (!x)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    DipConfig cfg = Dip_default();
+    int failures = 0;
+
+    for (size_t w = 0; w < sizeof(waves) / sizeof(waves[0]); w++)
+    {
+        make_wave(x, NUM_SAMPLES, waves[w].period, waves[w].width, waves[w].noise_v);
+
+        int d_scalar = 0, d_simd = 0;
+        double ns_scalar = time_fn(Dip_countScalar, x, NUM_SAMPLES, &cfg, &d_scalar);
+        double ns_simd   = time_fn(Dip_count,       x, NUM_SAMPLES, &cfg, &d_simd);
+
+        char name[64];
+        snprintf(name, sizeof(name), "Dip_countScalar %s", waves[w].name);
+        Bench_report(name, ns_scalar, NUM_SAMPLES);
+        snprintf(name, sizeof(name), "Dip_count %s", waves[w].name);
+        Bench_report(name, ns_simd, NUM_SAMPLES);
+
+        if (d_scalar != d_simd)
+        {
+            printf("  MISMATCH on %s: scalar %d, simd %d\n", waves[w].name, d_scalar, d_simd);
+            failures++;
+        }
+    }
+
+    free(x);
+    return failures;
+}
@@ -0,0 +1,75 @@
+// bench_flicker.c
+// Cost of one flicker analysis of a 20 kHz second, for each method.
+// Self-check: both must find the synthetic flicker within 0.5 Hz.
+#include "bench.h"
+#include "flicker.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_RATE_HZ 20000
+#define FLICKER_HZ    123.4
+#define NUM_REPEATS   50
+
+int Bench_flicker(void)
+{
+    sample_t *samples = malloc(sizeof(sample_t) * BENCH_RATE_HZ);
+    uint32_t *offsets = malloc(sizeof(uint32_t) * BENCH_RATE_HZ);
+    if (!samples || !offsets)
+    {
+        fprintf(stderr, "out of memory\n");
+        free(samples);
+        free(offsets);
+        return 1;
+    }
+    for (int i = 0; i < BENCH_RATE_HZ; i++)
+    {
+        double code = 2048.0 + 200.0 * sin(2.0 * 3.14159265358979323846 * FLICKER_HZ * i / BENCH_RATE_HZ);
+#ifdef SAMPLER_FIXED_POINT
+        samples[i] = (sample_t)lround(code);
+#else
+        samples[i] = code * 3.3 / 4096.0;
+#endif
+        offsets[i] = (uint32_t)((long long)i * 1000000 / BENCH_RATE_HZ);
+    }
+    Sampler_snapshot_t snap = {
+        .samples = samples, .offsets_us = offsets, .size = BENCH_RATE_HZ, .second = 0,
+        .rate_hz = BENCH_RATE_HZ,
+        .num_channels = 1, .channel_stride = BENCH_RATE_HZ,
+    };
+
+    static const FlickerMethod methods[] = { FLICKER_GOERTZEL, FLICKER_FFT };
+    int failures = 0;
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++)
+    {
+        if (!Flicker_init(methods[m], BENCH_RATE_HZ))
+        {
+            failures++;
+            continue;
+        }
+        Flicker_result_t fr;
+        long long t0 = Bench_nowNs();
+        for (int r = 0; r < NUM_REPEATS; r++)
+        {
+            Flicker_analyze(&snap, FLICKER_HZ, &fr);
+        }
+        double ns = (double)(Bench_nowNs() - t0) / NUM_REPEATS;
+
+        char name[64];
+        snprintf(name, sizeof(name), "Flicker_analyze %s", Flicker_methodName(methods[m]));
+        Bench_report(name, ns, BENCH_RATE_HZ);
+        if (fabs(fr.freq_hz - FLICKER_HZ) > 0.5)
+        {
+            printf("  %s found %.2f Hz, expected %.2f Hz\n",
+                   Flicker_methodName(methods[m]), fr.freq_hz, FLICKER_HZ);
+            failures++;
+        }
+        Flicker_cleanup();
+    }
+
+    free(samples);
+    free(offsets);
+    return failures;
+}
@@ -0,0 +1,76 @@
+// bench_period.c
+// Cost of Period_markEvent() with several threads marking at once.
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "periodTimer.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define MAX_THREADS 4
+#define NUM_ROUNDS  200
+#define MARKS_PER_ROUND 4096
+
+static pthread_barrier_t round_start;
+static pthread_barrier_t round_end;
+static int marks_per_thread;
+
+static void *marker(void *arg)
+{
+    (void)arg;
+    for (int r = 0; r < NUM_ROUNDS; r++)
+    {
+        pthread_barrier_wait(&round_start);
+        for (int i = 0; i < marks_per_thread; i++)
+        {
+            Period_markEvent(PERIOD_EVENT_SAMPLE_LIGHT);
+        }
+        pthread_barrier_wait(&round_end);
+    }
+    return NULL;
+}
+
+int Bench_period(void)
+{
+    Period_init();
+
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2)
+    {
+        marks_per_thread = MARKS_PER_ROUND / threads;
+
+        pthread_barrier_init(&round_start, NULL, (unsigned)threads + 1);
+        pthread_barrier_init(&round_end, NULL, (unsigned)threads + 1);
+        pthread_t tid[MAX_THREADS];
+        for (int t = 0; t < threads; t++)
+        {
+            pthread_create(&tid[t], NULL, marker, NULL);
+        }
+
+        long long busy_ns = 0;
+        for (int r = 0; r < NUM_ROUNDS; r++)
+        {
+            long long t0 = Bench_nowNs();
+            pthread_barrier_wait(&round_start);
+            pthread_barrier_wait(&round_end);
+            busy_ns += Bench_nowNs() - t0;
+
+            Period_statistics_t stats;
+            Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_LIGHT, &stats);
+        }
+
+        for (int t = 0; t < threads; t++)
+        {
+            pthread_join(tid[t], NULL);
+        }
+        pthread_barrier_destroy(&round_start);
+        pthread_barrier_destroy(&round_end);
+
+        // Wall time per mark as seen by each thread.
+        char name[64];
+        snprintf(name, sizeof(name), "Period_markEvent x%d threads", threads);
+        Bench_report(name, (double)busy_ns / ((double)NUM_ROUNDS * marks_per_thread), 0);
+    }
+
+    Period_cleanup();
+    return 0;
+}
@@ -0,0 +1,62 @@
+// bench_sampler.c
+// Cost of reading the previous second's history while the sampler runs:
+// the copying Sampler_getHistory() versus a shared snapshot.
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "sampler.h"
+#include "periodTimer.h"
+#include "hal/light_sensor.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_REPEATS 20000
+#define BENCH_RATE_HZ SAMPLER_MAX_RATE_HZ
+
+int Bench_sampler(void)
+{
+    Period_init();
+    if (LightSensor_Init("sim:noise=0.02,flicker_hz=100,dip_every=1000,rate=20000", 0, 3.3) != 0)
+    {
+        return 1;
+    }
+    if (!Sampler_initWithRate(BENCH_RATE_HZ))
+    {
+        LightSensor_Close();
+        Period_cleanup();
+        return 1;
+    }
+
+    // Let one full second accumulate so the history is realistic.
+    struct timespec ts = { 1, 0 };
+    nanosleep(&ts, NULL);
+    Sampler_moveCurrentDataToHistory();
+
+    int n = Sampler_getHistorySize();
+    int failures = (n <= 0);
+
+    long long t0 = Bench_nowNs();
+    for (int r = 0; r < NUM_REPEATS; r++)
+    {
+        int size = 0;
+        double *h = Sampler_getHistory(&size);
+        free(h);
+    }
+    Bench_report("Sampler_getHistory (malloc+copy)",
+                 (double)(Bench_nowNs() - t0) / NUM_REPEATS, n);
+
+    t0 = Bench_nowNs();
+    for (int r = 0; r < NUM_REPEATS; r++)
+    {
+        Sampler_snapshot_t snap;
+        Sampler_acquireHistory(&snap);
+        Sampler_releaseHistory(&snap);
+    }
+    Bench_report("Sampler_acquire/releaseHistory",
+                 (double)(Bench_nowNs() - t0) / NUM_REPEATS, n);
+
+    Sampler_cleanup();
+    LightSensor_Close();
+    Period_cleanup();
+    return failures;
+}
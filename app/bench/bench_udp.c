@@ -0,0 +1,64 @@
+// bench_udp.c
+// Throughput of formatting a second of samples into `history` datagrams.
+#include "bench.h"
+#include "udp.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define NUM_SAMPLES 2000
+#define NUM_REPEATS 500
+
+static size_t bytes_out;
+static int datagrams_out;
+
+static void count_datagram(const char *buf, size_t len, void *ctx)
+{
+    (void)buf;
+    (void)ctx;
+    bytes_out += len;
+    datagrams_out++;
+}
+
+int Bench_udpFormat(void)
+{
+    static sample_t samples[NUM_SAMPLES];
+    for (int i = 0; i < NUM_SAMPLES; i++)
+    {
+#ifdef SAMPLER_FIXED_POINT
+        samples[i] = (sample_t)(1241 + i % 1241);
+#else
+        samples[i] = 1.0 + (double)(i % 1000) / 1000.0;
+#endif
+    }
+
+    long long t0 = Bench_nowNs();
+    for (int r = 0; r < NUM_REPEATS; r++)
+    {
+        udp_format_history(samples, NUM_SAMPLES, count_datagram, NULL);
+    }
+    Bench_report("udp_format_history (text)",
+                 (double)(Bench_nowNs() - t0) / NUM_REPEATS, NUM_SAMPLES);
+
+    size_t text_bytes = bytes_out;
+    int text_datagrams = datagrams_out;
+
+    bytes_out = 0;
+    datagrams_out = 0;
+    uint32_t seq = 0;
+    t0 = Bench_nowNs();
+    for (int r = 0; r < NUM_REPEATS; r++)
+    {
+        udp_format_history_bin(samples, NUM_SAMPLES, (uint32_t)r, &seq, 3.3 / 4096.0,
+                               count_datagram, NULL);
+    }
+    Bench_report("udp_format_history_bin (binary)",
+                 (double)(Bench_nowNs() - t0) / NUM_REPEATS, NUM_SAMPLES);
+
+    printf("  bytes/second of history: text %zu in %d datagrams, binary %zu in %d datagrams\n",
+           text_bytes / NUM_REPEATS, text_datagrams / NUM_REPEATS,
+           bytes_out / NUM_REPEATS, datagrams_out / NUM_REPEATS);
+
+    return (text_datagrams == 0 || datagrams_out == 0);
+}
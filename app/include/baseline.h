@@ -0,0 +1,118 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+// Light-level baseline that dips are measured against. Fed one 12-bit ADC
+// code per sample by the sampling thread; every estimator is integer-only
+// and bounded per sample:
+//   BASELINE_EMA      exponential average with a time constant in ms, so
+//                     its response does not change with the sample rate.
+//   BASELINE_MEDIAN   median of the last window_ms of samples.
+//   BASELINE_TRIMMED  mean of that window with `trim` of the samples cut
+//                     from each end.
+// The windowed estimators keep a histogram of the window over the 4096
+// codes and track the ranks they need with cursors that move a bin at a
+// time (skipping empty 64-code blocks), so a sample costs O(1) instead of
+// re-sorting the window.
+//
+// With freeze_in_dips, samples the dip detector is currently treating as
+// part of a dip are left out, so a long dip does not drag the baseline
+// down. After freeze_max_ms in one dip the baseline tracks again, which
+// lets it follow a real drop in the light level.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BASELINE_CODES       4096   // 12-bit ADC
+#define BASELINE_BLOCK_BITS  6      // histogram blocks of 64 codes
+#define BASELINE_MAX_WINDOW_MS 10000
+
+typedef enum {
+    BASELINE_EMA = 0,
+    BASELINE_MEDIAN,
+    BASELINE_TRIMMED,
+} BaselineKind;
+
+typedef struct {
+    BaselineKind kind;
+    double tau_ms;          // EMA time constant
+    double window_ms;       // median / trimmed-mean window
+    double trim;            // fraction cut from each end (0 .. 0.45)
+    bool   freeze_in_dips;  // leave samples inside a dip out
+    double freeze_max_ms;   // longest freeze per dip (0: no limit)
+} BaselineConfig;
+
+// Bin holding the sample of rank `rank` (0-based) in the window, with the
+// count and sum of the samples in lower bins.
+typedef struct {
+    int      bin;
+    uint32_t below;
+    uint64_t sum_below;
+} BaselineCursor;
+
+typedef struct {
+    BaselineConfig cfg;
+    bool     primed;        // at least one sample seen
+    int32_t  value_q16;     // current baseline, Q16 ADC code
+    long long frozen;       // samples left out by freeze_in_dips
+
+    int64_t  alpha_q32;     // EMA weight of a new sample, Q32
+    uint32_t trim_q16;      // cfg.trim, Q16
+
+    uint16_t *ring;         // window of codes (windowed kinds)
+    int      window;
+    int      head;
+    int      count;
+    uint64_t sum;
+    uint32_t *hist;         // BASELINE_CODES bins
+    uint32_t *blocks;       // samples per 64-code block
+    BaselineCursor lo;      // median, or low trim edge
+    BaselineCursor hi;      // high trim edge
+
+    int      freeze_max;    // samples
+    int      freeze_run;
+} Baseline;
+
+// Prepare a baseline for `rate_hz` samples per second. Allocates the
+// window for the windowed kinds; returns false if that fails.
+bool Baseline_init(Baseline *b, const BaselineConfig *cfg, int rate_hz);
+void Baseline_free(Baseline *b);
+// Fold in one sample. `in_dip` says whether the dip detector currently
+// considers the signal to be inside a dip. Returns false if the sample
+// was left out (frozen).
+bool Baseline_push(Baseline *b, uint16_t code, bool in_dip);
+
+static inline int32_t Baseline_valueQ16(const Baseline *b)
+{
+    return b->value_q16;
+}
+
+// "ema" / "median" / "trimmed", and back (false for an unknown name).
+const char *Baseline_kindName(BaselineKind kind);
+bool Baseline_parseKind(const char *name, BaselineKind *kind);
+// Apply one command-line option to `cfg`, for the programs that share
+// them: --baseline=<kind>, --baseline-tau-ms=<ms>, --baseline-window-ms=<ms>,
+// --baseline-trim=<f>, --baseline-freeze[=<max ms>]. Returns false if
+// `arg` is not one of these.
+bool Baseline_parseArg(const char *arg, BaselineConfig *cfg);
+// Usage lines for those options.
+#define BASELINE_USAGE \
+"  --baseline=<ema|median|trimmed>  Baseline dips are measured against (default: ema)\n" \
+"  --baseline-tau-ms=<ms>           EMA time constant (default: 1000)\n" \
+"  --baseline-window-ms=<ms>        Median / trimmed-mean window (default: 500)\n" \
+"  --baseline-trim=<f>              Fraction trimmed from each end (default: 0.10)\n" \
+"  --baseline-freeze[=<ms>]         Hold the baseline inside dips, at most <ms> (default: 500)\n"
+// One-line description of a configuration, e.g. for status output.
+int Baseline_describe(const BaselineConfig *cfg, char *buf, size_t len);
+
+// 1 s EMA: at 1 kHz this is the sampler's original 0.999 / 0.001 average.
+static inline BaselineConfig Baseline_default(void)
+{
+    BaselineConfig c = {
+        .kind = BASELINE_EMA, .tau_ms = 1000.0, .window_ms = 500.0, .trim = 0.1,
+        .freeze_in_dips = false, .freeze_max_ms = 500.0,
+    };
+    return c;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+// Decimation stage between the raw samples and the dip detector. Each
+// channel's 12-bit codes are low-pass filtered and cut down by `factor`,
+// so at high sample rates dips are judged on a cleaner, lower-rate stream
+// (and the baseline runs at that rate too) while the history keeps every
+// raw sample.
+//   DECIMATOR_NONE  codes pass straight through (factor 1).
+//   DECIMATOR_CIC   cascaded integrator-comb of `cic_order` stages: no
+//                   multiplies, but its passband droops (sinc^order).
+//   DECIMATOR_FIR   Hamming-windowed sinc of factor * taps_per_phase taps,
+//                   cut off just below the output Nyquist frequency. Only
+//                   every factor-th output is computed (the polyphase form:
+//                   no work goes into outputs that decimation drops).
+// Both are integer-only and process a block of samples per call into
+// state sized once by Decimator_init. Outputs are rounded back to codes.
+// The filter delays the stream by about taps_per_phase / 2 output samples
+// (FIR) or order / 2 (CIC). The first sample primes the filter as if the
+// signal had always been at that level, so start-up does not look like a
+// dip.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DECIMATOR_MAX_FACTOR     64
+#define DECIMATOR_MAX_CIC_ORDER  4
+#define DECIMATOR_MAX_TAPS_PER_PHASE 32
+// factor 0 decimates down to about this rate.
+#define DECIMATOR_AUTO_HZ        1000
+
+typedef enum {
+    DECIMATOR_NONE = 0,
+    DECIMATOR_CIC,
+    DECIMATOR_FIR,
+} DecimatorKind;
+
+typedef struct {
+    DecimatorKind kind;
+    int factor;             // inputs per output (0: down to ~DECIMATOR_AUTO_HZ)
+    int cic_order;          // CIC stages (1 .. DECIMATOR_MAX_CIC_ORDER)
+    int taps_per_phase;     // FIR length is factor * taps_per_phase
+} DecimatorConfig;
+
+typedef struct {
+    DecimatorConfig cfg;    // as resolved for the input rate
+    double   out_rate_hz;
+    bool     primed;
+    int      phase;         // inputs since the last output
+
+    int      taps;          // FIR
+    int32_t *coef;          // Q15, oldest sample first
+    uint16_t *line;         // 2 * taps: each input is stored twice so the
+    int      pos;           // newest `taps` are always contiguous
+
+    uint32_t integ[DECIMATOR_MAX_CIC_ORDER];    // CIC, modulo 2^32
+    uint32_t comb[DECIMATOR_MAX_CIC_ORDER];
+    uint32_t gain;          // factor^order
+} Decimator;
+
+// Prepare a decimator for `rate_hz` input samples per second. Allocates
+// the FIR coefficients and delay line; returns false if that fails.
+bool Decimator_init(Decimator *d, const DecimatorConfig *cfg, int rate_hz);
+void Decimator_free(Decimator *d);
+// Filter in[0..n) and append the decimated codes to `out` (room for
+// n / factor + 1). Returns how many were written.
+int Decimator_process(Decimator *d, const uint16_t *in, int n, uint16_t *out);
+
+static inline int Decimator_factor(const Decimator *d)
+{
+    return d->cfg.factor;
+}
+
+// "none" / "cic" / "fir", and back (false for an unknown name).
+const char *Decimator_kindName(DecimatorKind kind);
+bool Decimator_parseKind(const char *name, DecimatorKind *kind);
+// Apply one command-line option to `cfg`, for the programs that share
+// them: --decim=<kind>, --decim-factor=<N>, --decim-order=<N>,
+// --decim-taps=<N>. Returns false if `arg` is not one of these.
+bool Decimator_parseArg(const char *arg, DecimatorConfig *cfg);
+// Usage lines for those options.
+#define DECIMATOR_USAGE \
+"  --decim=<fir|cic|none>           Filter ahead of the dip detector (default: fir)\n" \
+"  --decim-factor=<N>               Samples per filtered sample (default: rate / 1000)\n" \
+"  --decim-order=<N>                CIC stages (default: 3)\n" \
+"  --decim-taps=<N>                 FIR taps per phase (default: 8)\n"
+// One-line description of `cfg` at an input rate, e.g. for status output.
+int Decimator_describe(const DecimatorConfig *cfg, int rate_hz, char *buf, size_t len);
+
+// FIR down to about 1 kHz: at the default 1 kHz rate this passes samples
+// through unchanged.
+static inline DecimatorConfig Decimator_default(void)
+{
+    DecimatorConfig c = { .kind = DECIMATOR_FIR, .factor = 0, .cic_order = 3, .taps_per_phase = 8 };
+    return c;
+}
+
+#endif
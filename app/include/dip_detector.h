@@ -1,20 +1,63 @@
 #ifndef DIP_DETECTOR_H
 #define DIP_DETECTOR_H
 #include <stdbool.h>
+#include <stdint.h>
+
+// Fixed-point format for the integer (ADC code) path: Q16 codes.
+#define DIP_Q16_SHIFT 16
+#define DIP_Q16_ONE   (1 << DIP_Q16_SHIFT)
 
 typedef struct {
     double trigger_delta;   // volts below  average to trigger a dip 
     double release_delta;   // volts below average to release (e.g., 0.07) hysteresis
-    int    min_width;       // require at least this many consecutive samples below trigger 
-    int    min_gap;         // after a dip ends, require this many samples above release before allowing another
+    double min_width_ms;    // require the signal below trigger at least this long
+    double min_gap_ms;      // after a dip ends, require this long above release before allowing another
 } DipConfig;
 
+// Streaming detector: same state machine as Dip_count(), but its state
+// persists between calls, so a dip that straddles a window edge is
+// counted exactly once (in the window where it reaches min_width).
+// The widths are fixed in samples for the stream's rate when it starts.
+typedef struct {
+    DipConfig cfg;
+    int min_width;          // cfg.min_width_ms in samples (at least 1)
+    int min_gap;            // cfg.min_gap_ms in samples
+    int state;              // ABOVE / BELOW_WAIT / BELOW_OK / GAP
+    int run;
+    int gap;
+    long long total;        // dips counted since Dip_streamInit()
+    int32_t trigger_q16;    // cfg deltas as Q16 ADC codes (integer path)
+    int32_t release_q16;
+} DipStream;
+
+
+// Count dips in x[0..n), sampled at rate_hz, against a fixed average. Uses a SIMD block scan
+// (NEON / AVX / SSE2, scalar fallback) to skip stretches where the state
+// cannot change; the result is identical to Dip_countScalar().
+int Dip_count(const double *x, int n, double ema, const DipConfig *cfg, double rate_hz);
+// Reference per-sample implementation (kept for verification/benchmarks).
+int Dip_countScalar(const double *x, int n, double ema, const DipConfig *cfg, double rate_hz);
+
+// Start a stream of samples arriving at rate_hz.
+void Dip_streamInit(DipStream *s, const DipConfig *cfg, double rate_hz);
+// Feed one sample against the current average; returns 1 if this sample
+// completed a dip, else 0.
+int  Dip_streamPush(DipStream *s, double v, double ave);
+// True while the stream is below the trigger (or not yet released).
+bool Dip_streamInDip(const DipStream *s);
 
-int Dip_count(const double *x, int n, double ema, const DipConfig *cfg);
+// Integer path: samples are raw 12-bit ADC codes and the average is a Q16
+// code. Dip_streamSetCodeScale() pre-converts the volt thresholds to codes
+// once, so pushing a sample involves no floating point.
+void Dip_streamSetCodeScale(DipStream *s, double volts_per_code);
+int  Dip_streamPushCode(DipStream *s, uint16_t code, int32_t ave_q16);
+int  Dip_countCodes(const uint16_t *x, int n, int32_t ave_q16, const DipConfig *cfg,
+                    double rate_hz, double volts_per_code);
 
+// 2 ms / 1 ms: the original 2- and 1-sample widths at 1 kHz.
 static inline DipConfig Dip_default(void) 
 {
-    DipConfig c = { .trigger_delta = 0.10, .release_delta = 0.07, .min_width = 2, .min_gap = 1 };
+    DipConfig c = { .trigger_delta = 0.10, .release_delta = 0.07, .min_width_ms = 2.0, .min_gap_ms = 1.0 };
     return c;
 }
 
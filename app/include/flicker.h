@@ -0,0 +1,62 @@
+#ifndef FLICKER_H
+#define FLICKER_H
+
+// Flicker frequency estimator: finds the dominant flicker frequency and
+// its amplitude in one second of samples, so the commanded LED frequency
+// can be checked against what the sensor actually sees (a dropped PWM
+// shows as no flicker, a frequency above half the sample rate as an
+// alias).
+//   FLICKER_GOERTZEL  a bank of Goertzel filters spaced half a bin apart
+//                     around where the commanded frequency should appear
+//                     (its alias, if above Nyquist). Only looks near the
+//                     expected frequency, so a stronger unrelated flicker
+//                     cannot mask it.
+//   FLICKER_FFT       Hann-windowed radix-2 real FFT of the whole second
+//                     (N/2-point complex FFT plus a split pass), searched
+//                     for the largest peak. The plan (twiddles, bit
+//                     reversal, buffers) is built once by Flicker_init, so
+//                     an analysis allocates nothing.
+// Both refine the peak by parabolic interpolation. They work on the
+// samples interpolated onto an even grid at the snapshot's rate, placed
+// by their timestamps (which need not be evenly spaced). Analysis runs on
+// the caller's thread (the main loop), never on the sampling thread.
+
+#include "sampler.h"
+
+#include <stdbool.h>
+
+// Peaks below this amplitude count as no flicker.
+#define FLICKER_MIN_AMPLITUDE_V 0.01
+// Frequencies below this are treated as drift, not flicker.
+#define FLICKER_MIN_HZ 2.0
+
+typedef enum {
+    FLICKER_OFF = 0,
+    FLICKER_GOERTZEL,
+    FLICKER_FFT,
+} FlickerMethod;
+
+typedef struct {
+    double rate_hz;         // rate of the grid the samples were placed on
+    double freq_hz;         // dominant flicker frequency (0: none found)
+    double amplitude_v;     // its peak amplitude (fundamental), volts
+    double expected_hz;     // commanded frequency (0: LED off)
+    double alias_hz;        // where expected_hz appears at this rate
+    bool   aliased;         // expected_hz is above half the sample rate
+} Flicker_result_t;
+
+// Plan for seconds of up to `max_samples` samples (longer ones are cut).
+// Returns false if the FFT buffers cannot be allocated.
+bool Flicker_init(FlickerMethod method, int max_samples);
+void Flicker_cleanup(void);
+FlickerMethod Flicker_getMethod(void);
+// Analyse the primary channel of `snap` against the commanded frequency.
+// Returns false (and a zeroed result) if there are too few samples or the
+// estimator is off.
+bool Flicker_analyze(const Sampler_snapshot_t *snap, double expected_hz, Flicker_result_t *out);
+
+// "off" / "goertzel" / "fft", and back (false for an unknown name).
+const char *Flicker_methodName(FlickerMethod method);
+bool Flicker_parseMethod(const char *name, FlickerMethod *method);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// On-disk sample journal. A background thread copies each completed
+// second out of the sampler's history ring into fixed-size segment files
+// that are preallocated and mmap'd, so recording costs the sampling path
+// nothing and the writer itself makes no write() calls. When a segment
+// fills up, the journal rotates to the next one and, if max_segments is
+// set, deletes the oldest.
+//
+// Only the primary channel is recorded when several are sampled.
+//
+// Segment file `journal-NNNNNN.seg` (all fields little-endian):
+//   journal_segment_header_t, then records back to back, each 8-byte
+//   aligned: journal_record_header_t, `count` u16 12-bit ADC codes
+//   (padded to 4 bytes), then `count` u32 µs offsets from start_ns.
+// `used_bytes` in the segment header covers only complete records.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOURNAL_SEGMENT_MAGIC   0x314A444Cu    // "LDJ1"
+#define JOURNAL_RECORD_MAGIC    0x43455253u    // "SREC"
+#define JOURNAL_VERSION         1
+#define JOURNAL_DEFAULT_SEGMENT_BYTES (16u * 1024 * 1024)
+
+typedef struct {
+    uint32_t magic;             // JOURNAL_SEGMENT_MAGIC
+    uint16_t version;           // JOURNAL_VERSION
+    uint16_t header_bytes;      // sizeof(journal_segment_header_t)
+    uint32_t segment_index;
+    uint32_t sample_rate_hz;
+    uint64_t segment_bytes;     // file size
+    uint64_t used_bytes;        // header + complete records
+    uint32_t record_count;
+    uint32_t reserved;
+    double   volts_per_code;
+} journal_segment_header_t;
+
+typedef struct {
+    uint32_t magic;             // JOURNAL_RECORD_MAGIC
+    uint32_t record_bytes;      // whole record, header included
+    int64_t  second;            // index of the second since sampler start
+    int64_t  start_ns;          // CLOCK_MONOTONIC start of that second
+    uint32_t count;             // samples
+    uint32_t dips;
+} journal_record_header_t;
+
+// Offsets of a record's arrays, and its aligned size, for `count` samples.
+#define JOURNAL_CODES_OFFSET         sizeof(journal_record_header_t)
+#define JOURNAL_OFFSETS_OFFSET(count) \
+    (JOURNAL_CODES_OFFSET + (((size_t)(count) * 2 + 3) & ~(size_t)3))
+#define JOURNAL_RECORD_BYTES(count) \
+    ((JOURNAL_OFFSETS_OFFSET(count) + (size_t)(count) * 4 + 7) & ~(size_t)7)
+
+typedef struct {
+    const char *dir;            // directory for the segment files
+    size_t segment_bytes;       // 0: JOURNAL_DEFAULT_SEGMENT_BYTES
+    int max_segments;           // segments kept on disk; 0: keep all
+} JournalConfig;
+
+typedef struct {
+    long long seconds_written;
+    long long seconds_missed;   // left the ring uncopied, or no segment open
+    int segment_index;          // segment being written
+} Journal_stats_t;
+
+// Start/stop the journal thread (after Sampler_init / before
+// Sampler_cleanup). Start returns false if the first segment cannot be
+// created.
+bool Journal_start(const JournalConfig *cfg);
+void Journal_stop(void);
+void Journal_getStats(Journal_stats_t *stats);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+// Enum <-> name tables for the command-line options and status output.
+// A module keeps a `static const char *const names[]` indexed by its enum
+// (designated initializers, no gaps) and maps through these helpers.
+
+#include <stdbool.h>
+
+#define NAMES_COUNT(names) ((int)(sizeof(names) / sizeof((names)[0])))
+
+// names[value], or "?" when `value` is out of range.
+const char *Names_lookup(const char *const *names, int count, int value);
+// Index of `name` in names[0..count). False (and *value untouched) if it
+// is not there.
+bool Names_parse(const char *const *names, int count, const char *name, int *value);
+
+#endif
@@ -14,9 +14,16 @@
 //     data collected for this event (but not others).
 //     For example, call this function once a second to get timing
 //     information to print to the screen.
+// Period_markEvent() is lock-free and may be called from several
+// threads. Each mark records the time since the previous mark into a
+// log-linear (HDR-style) histogram, so memory is constant however many
+// events occur between calls to Period_getStatisticsAndClear().
 
-// Maximum number of timestamps to record for a given event.
-#define MAX_EVENT_TIMESTAMPS (1024*4)
+// Histogram resolution: 2^PERIOD_HIST_SUB_BITS linear sub-buckets per
+// power of two (relative error < 1%), covering periods up to
+// 2^(PERIOD_HIST_MAX_BITS) ns (about 68 s).
+#define PERIOD_HIST_SUB_BITS 7
+#define PERIOD_HIST_MAX_BITS 36
 
 enum Period_whichEvent {
     PERIOD_EVENT_SAMPLE_LIGHT,
@@ -29,6 +36,13 @@ typedef struct {
     double minPeriodInMs;
     double maxPeriodInMs;
     double avgPeriodInMs;
+    double stdDevPeriodInMs;
+    // Percentiles, accurate to the histogram's bucket width.
+    double p50PeriodInMs;
+    double p90PeriodInMs;
+    double p99PeriodInMs;
+    double p999PeriodInMs;
+    int numOverflowed;      // periods beyond the histogram's range
 } Period_statistics_t;
 
 // Initialize/cleanup the module's data structures.
@@ -0,0 +1,39 @@
+#ifndef RT_THREAD_H
+#define RT_THREAD_H
+
+// Scheduling attributes for the app's threads: SCHED_FIFO priority,
+// niceness, CPU affinity, stack size and stack pre-faulting. Each thread
+// applies its own config when it starts; steps the process lacks the
+// privilege for (e.g. SCHED_FIFO without CAP_SYS_NICE) print a warning
+// and are skipped, so the app still runs as a normal user.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    int fifo_priority;              // 1..99: run SCHED_FIFO; 0: stay SCHED_OTHER
+    int nice;                       // SCHED_OTHER niceness; 0 leaves it alone
+    int cpu;                        // pin to this CPU; -1 for any
+    size_t stack_bytes;             // thread stack size; 0 for the default
+    size_t prefault_stack_bytes;    // stack touched at start; 0 for none
+} RtThreadConfig;
+
+static inline RtThreadConfig Rt_default(void)
+{
+    RtThreadConfig c = { 0, 0, -1, 0, 0 };
+    return c;
+}
+
+// Lock current and future pages in RAM (mlockall) so the sampling path
+// never takes a page fault. Returns false (with a warning) on failure.
+bool Rt_lockMemory(void);
+
+// Fill `attr` (already initialized) from `cfg`: currently the stack size.
+void Rt_initAttr(pthread_attr_t *attr, const RtThreadConfig *cfg);
+
+// Apply `cfg` to the calling thread; `name` labels warnings and the
+// thread itself. Returns false if any step failed.
+bool Rt_applyToSelf(const char *name, const RtThreadConfig *cfg);
+
+#endif
@@ -10,25 +10,201 @@
 // To make easy to work with the data, the app must call
 // Sampler_moveCurrentDataToHistory() each second to trigger this
 // module to move the current samples into the history.
+//
+// The getters never take a lock: each second's samples live in a frame
+// from a small preallocated pool, and readers share that frame through a
+// reference-counted snapshot, so readers cannot stall sampling.
 #ifndef _SAMPLER_H_
 #define _SAMPLER_H_
+
+#include "baseline.h"
+#include "decimator.h"
+#include "dip_detector.h"
+#include "rt_thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sample representation. When built with SAMPLER_FIXED_POINT, samples stay
+// raw 12-bit ADC codes from the sensor through the average and dip
+// detection (a quarter of the memory, no FP in the sampling loop);
+// otherwise they are volts. Use Sampler_toVolts() for presentation.
+#ifdef SAMPLER_FIXED_POINT
+typedef uint16_t sample_t;
+#else
+typedef double sample_t;
+#endif
+
+typedef struct sampler_frame sampler_frame_t;
+
+// Most ADC channels sampled together (the MCP3208 has eight inputs).
+#define SAMPLER_MAX_CHANNELS 8
+
+// Read-only view of the previous complete second. The samples stay valid
+// (and unchanged) until the snapshot is released. Sample i was due
+// offsets_us[i] microseconds after start_ns (CLOCK_MONOTONIC): its tick's
+// deadline plus its place in the batch (i * tick period / batch), so the
+// offsets are evenly spaced apart from dropped ticks. The SPI read itself
+// runs late by the tick's wakeup latency (see Sampler_timing_t).
+// `samples` and `dips` are the primary channel's; with several channels,
+// channel k's `size` samples start at samples + k * channel_stride (see
+// Sampler_snapshotChannel()) and share offsets_us.
+typedef struct {
+    const sample_t *samples;
+    const uint32_t *offsets_us;
+    long long start_ns;
+    int size;
+    int dips;                   // dips detected during that second
+    long long second;           // index of that second since Sampler_init (-1: none)
+    int rate_hz;                // sample rate the second was taken at
+    int num_channels;
+    int channel_stride;
+    int channel_dips[SAMPLER_MAX_CHANNELS];
+    sampler_frame_t *frame;     // owning frame (internal)
+} Sampler_snapshot_t;
+
+// Tick timing. Each timer tick has an absolute CLOCK_MONOTONIC deadline
+// (start + k * period). A tick serviced more than half a period after its
+// deadline is late; ticks that passed entirely while the thread was held
+// up are dropped (skipped, not burst-read), so samples stay evenly spaced.
+typedef struct {
+    long long ticks;            // ticks serviced since Sampler_init
+    long long late_ticks;       // of those, serviced late
+    long long dropped_ticks;    // ticks skipped after an overrun
+    // Deadline-to-wakeup latency over the ticks since the previous call.
+    int    latency_count;
+    double avg_latency_us;
+    double max_latency_us;
+} Sampler_timing_t;
+
+// Running counters and levels. The sampling thread publishes them once per
+// tick under a sequence lock, so any thread can read a consistent copy
+// without ever making the sampler wait.
+typedef struct {
+    long long total_samples;    // samples (scans) stored since Sampler_init
+    long long dropped_samples;  // not stored: frame full or SPI read failed
+    long long read_errors;      // failed SPI reads
+    int    second_samples;      // samples so far in the second being filled
+    int    num_channels;
+    double average[SAMPLER_MAX_CHANNELS];     // baseline, volts
+    double second_min[SAMPLER_MAX_CHANNELS];  // volts, second being filled
+    double second_max[SAMPLER_MAX_CHANNELS];
+} Sampler_stats_t;
+
+// Supported sample rates (samples per second). Above 1 kHz, each 1 ms
+// timer tick reads several conversions in one batched SPI transfer.
+#define SAMPLER_DEFAULT_RATE_HZ 1000
+#define SAMPLER_MIN_RATE_HZ     1000
+#define SAMPLER_MAX_RATE_HZ     20000
+
+// Seconds of history kept in the ring (see Sampler_setHistorySeconds).
+#define SAMPLER_DEFAULT_HISTORY_SECONDS 60
+#define SAMPLER_MAX_HISTORY_SECONDS     3600
+// Cap on the frame pool's memory (all of it allocated at init, and pinned
+// with --mlock); the ring keeps fewer seconds if the frames need more.
+#define SAMPLER_MAX_HISTORY_BYTES       (64u * 1024 * 1024)
+
 // Begin/end the background thread which samples light levels.
-void Sampler_init(void);
+// Sampler_init() samples at SAMPLER_DEFAULT_RATE_HZ; the rate given to
+// Sampler_initWithRate() is clamped to the supported range, and lowered
+// further if the SPI transfers for every channel at that rate would not
+// fit in a timer tick (measured at init; a warning says so). Returns false
+// (after printing why) if the sampler could not start.
+// All history snapshots must be released before Sampler_cleanup().
+bool Sampler_init(void);
+bool Sampler_initWithRate(int rate_hz);
 void Sampler_cleanup(void);
-// Must be called once every 1s.
+// Set the dip detector parameters (call before Sampler_init; defaults to
+// Dip_default()). Dips are detected per sample by the sampling thread
+// against the running average, so no re-scan of the history is needed.
+// The widths are in ms and apply at the decimated rate.
+void Sampler_setDipConfig(const DipConfig *cfg);
+// Choose the ADC channels scanned each tick (call before Sampler_init;
+// defaults to the channel the light sensor was initialised with). All
+// channels are read in the same batched SPI transfer and each gets its
+// own average and dip detector; the first is the primary channel that the
+// single-channel getters report. Returns false for an invalid list. Each
+// channel adds to the transfer, so Sampler_init may lower the rate.
+bool Sampler_setChannels(const int *channels, int n);
+int Sampler_getNumChannels(void);
+// ADC channel number of channel `index` (-1 if out of range).
+int Sampler_getChannelId(int index);
+// Set the baseline that dips are measured against (call before
+// Sampler_init; defaults to Baseline_default(), a 1 s EMA). Every channel
+// gets its own baseline with these settings.
+void Sampler_setBaselineConfig(const BaselineConfig *cfg);
+void Sampler_getBaselineConfig(BaselineConfig *cfg);
+// Set the decimation stage ahead of each channel's baseline and dip
+// detector (call before Sampler_init; defaults to Decimator_default(),
+// down to about 1 kHz). History keeps the raw samples.
+void Sampler_setDecimatorConfig(const DecimatorConfig *cfg);
+void Sampler_getDecimatorConfig(DecimatorConfig *cfg);
+// Rate of the decimated stream the baseline and dip detector run at.
+double Sampler_getDipRate(void);
+// Samples of channel `index` left out of its baseline while in a dip.
+long long Sampler_getBaselineFrozen(int index);
+// Set the sampling thread's scheduling attributes (call before
+// Sampler_init; defaults to Rt_default(), i.e. an ordinary thread).
+void Sampler_setThreadConfig(const RtThreadConfig *cfg);
+// Set how many complete seconds the history ring keeps (call before
+// Sampler_init; 1..SAMPLER_MAX_HISTORY_SECONDS). Memory is one frame of
+// 2 * rate samples per channel for each second kept; Sampler_init keeps
+// fewer seconds if the pool would exceed SAMPLER_MAX_HISTORY_BYTES, and
+// Sampler_getHistorySeconds() then reports what is actually kept.
+void Sampler_setHistorySeconds(int seconds);
+int Sampler_getHistorySeconds(void);
+// Get the sample rate the sampler was started with.
+int Sampler_getSampleRate(void);
+// Must be called once every 1s (from a single thread).
 // Moves the samples that it has been collecting this second into
 // the history, which makes the samples available for reads (below).
 void Sampler_moveCurrentDataToHistory(void);
 // Get the number of samples collected during the previous complete second.
 int Sampler_getHistorySize(void);
-// Get a copy of the samples in the sample history.
+// Get the number of dips detected during the previous complete second.
+int Sampler_getHistoryDips(void);
+// Share the samples in the sample history without copying.
+// Every acquire must be paired with a release. All readers of the same
+// second share one frame; a snapshot held across a second boundary pins
+// its frame, and the pool only has spares for a couple of those.
+void Sampler_acquireHistory(Sampler_snapshot_t *snap);
+void Sampler_releaseHistory(Sampler_snapshot_t *snap);
+// Older seconds from the ring, by index (as in Sampler_snapshot_t.second).
+// Sampler_getHistoryRange() gives the indexes currently held (-1: none).
+// acquireSecond returns false (and an empty snapshot) if that second is
+// not in the ring. acquireRange/acquireLast fill `snaps` with the seconds
+// still held, oldest first, and return how many; release them with
+// Sampler_releaseRange(). Pinned seconds use the pool's few spare frames,
+// so release them promptly.
+void Sampler_getHistoryRange(long long *oldest, long long *latest);
+bool Sampler_acquireSecond(long long second, Sampler_snapshot_t *snap);
+int Sampler_acquireRange(long long first_second, int count, Sampler_snapshot_t *snaps);
+int Sampler_acquireLast(int k, Sampler_snapshot_t *snaps);
+void Sampler_releaseRange(Sampler_snapshot_t *snaps, int n);
+// Samples of channel `index` in a snapshot (NULL if out of range).
+const sample_t *Sampler_snapshotChannel(const Sampler_snapshot_t *snap, int index);
+// Convert a stored sample to volts, or to a 12-bit ADC code.
+double Sampler_toVolts(sample_t sample);
+uint16_t Sampler_toCode(sample_t sample);
+// Volts represented by one ADC code.
+double Sampler_getVoltsPerCode(void);
+// Get a copy of the samples in the sample history (in volts).
 // Returns a newly allocated array and sets `size` to be the
 // number of elements in the returned array (output-only parameter).
 // The calling code must call free() on the returned pointer.
 // Note: It provides both data and size to ensure consistency.
 double* Sampler_getHistory(int *size);
-// Get the average light level (not tied to the history).
+// Same, plus a parallel array of each sample's µs offset from the start
+// of that second, returned through `offsets_us` (also to be free()d).
+double* Sampler_getHistoryWithTimes(int *size, uint32_t **offsets_us);
+// Get the baseline light level (not tied to the history).
 double Sampler_getAverageReading(void);
-// Get the total number of light level samples taken so far.
+double Sampler_getChannelAverage(int index);
+// Get the total number of light level samples (scans) taken so far.
 long long Sampler_getNumSamplesTaken(void);
+// Copy the published counters and levels (never blocks the sampler).
+void Sampler_getStats(Sampler_stats_t *stats);
+// Get the tick counters, and the latency since the previous call (which
+// resets it; call from a single thread, e.g. once a second).
+void Sampler_getTiming(Sampler_timing_t *timing);
 #endif
\ No newline at end of file
@@ -6,8 +6,58 @@
 #include <stdatomic.h>
 #include <stddef.h>   
 
+#include "sampler.h"
+#include "periodTimer.h"
+#include "rt_thread.h"
+#include "flicker.h"
+
+// Clients that send `subscribe` get pushed updates (bounded table).
+#define UDP_MAX_SUBSCRIBERS 16
+
+// What the main loop knows about each completed second.
+typedef struct {
+    long long second;
+    int samples;
+    double average;
+    int dips;
+    Period_statistics_t timing;
+    Sampler_timing_t ticks;     // tick counters and that second's latency
+    Flicker_result_t flicker;   // dominant flicker vs. the commanded LED frequency
+} udp_second_summary_t;
+
+// Scheduling attributes for the server thread (call before udp_start;
+// typically a positive nice so it yields to the sampler).
+void udp_set_thread_config(const RtThreadConfig *cfg);
 bool udp_start(uint16_t port, _Atomic bool *request_exit);
 void udp_stop(void);
-bool udp_send(const void *data, size_t len);
+// Push one second's summary line (and, to clients that subscribed with
+// `subscribe history`, that second's history.bin datagrams) to every
+// subscriber, batched with sendmmsg(). Call once per second from one thread.
+void udp_publish_second(const udp_second_summary_t *summary, const Sampler_snapshot_t *hist);
+
+// Format samples the way the `history` command sends them ("%.3f",
+// 10 per line) into datagrams of at most MAXIMUM_SEND bytes; `emit` is
+// called once per datagram. Exposed for benchmarking.
+typedef void (*udp_emit_fn)(const char *buf, size_t len, void *ctx);
+void udp_format_history(const sample_t *samples, int count, udp_emit_fn emit, void *ctx);
+
+// Binary history (`history.bin` command). Each datagram is at most 1472
+// bytes (no IP fragmentation) and starts with this little-endian header:
+//   u16 magic    UDP_HISTORY_BIN_MAGIC
+//   u8  version  UDP_HISTORY_BIN_VERSION
+//   u8  flags    reserved, 0
+//   u32 seq      datagram sequence number (detects loss/reordering)
+//   u32 second   index of the second the samples belong to
+//   u16 total    samples in that second
+//   u16 offset   index of this datagram's first sample within the second
+//   u16 count    samples in this datagram
+//   f32 scale    volts per code
+// followed by `count` u16 12-bit ADC codes.
+#define UDP_HISTORY_BIN_MAGIC       0x484C     // "LH" on the wire
+#define UDP_HISTORY_BIN_VERSION     1
+#define UDP_HISTORY_BIN_HEADER_SIZE 22
+void udp_format_history_bin(const sample_t *samples, int count, uint32_t second,
+                            uint32_t *seq, double volts_per_code,
+                            udp_emit_fn emit, void *ctx);
 
 #endif 
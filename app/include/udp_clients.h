@@ -0,0 +1,46 @@
+#ifndef UDP_CLIENTS_H
+#define UDP_CLIENTS_H
+
+// Per-client state for the UDP server: a small hash table keyed by the
+// client's address, holding its last command ("<enter>" repeats it),
+// subscription flags and a rate-limit token bucket. When the table is
+// full the least recently seen client is evicted (subscribers last).
+// All functions are thread-safe.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define UDP_MAX_CLIENTS        64
+#define UDP_CLIENT_COMMAND_LEN 32
+
+// Token bucket: a client may burst this many commands, then is limited
+// to UDP_RATE_PER_SEC; commands over the limit are dropped.
+#define UDP_RATE_BURST   20.0
+#define UDP_RATE_PER_SEC 50.0
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    bool want_history;
+} udp_subscriber_t;
+
+void udp_clients_reset(void);
+
+// Look up (or add) the client and charge one command to its bucket.
+// Returns false if the command must be dropped (rate limited).
+bool udp_clients_admit(const struct sockaddr *addr, socklen_t len, long long now_ns);
+
+// The client's last command ("" if none), and recording a new one.
+void udp_clients_get_last_command(const struct sockaddr *addr, socklen_t len, char *out, size_t out_len);
+void udp_clients_set_last_command(const struct sockaddr *addr, socklen_t len, const char *cmd);
+
+// Subscription flags; subscribe returns false once `max_subscribers`
+// other clients are already subscribed.
+bool udp_clients_subscribe(const struct sockaddr *addr, socklen_t len, bool want_history, int max_subscribers);
+void udp_clients_unsubscribe(const struct sockaddr *addr, socklen_t len);
+
+// Copy out up to `max` current subscribers; returns how many.
+int udp_clients_get_subscribers(udp_subscriber_t *out, int max);
+
+#endif
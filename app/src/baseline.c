@@ -0,0 +1,273 @@
+#include "baseline.h"
+#include "dip_detector.h"
+#include "names.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE (1 << BASELINE_BLOCK_BITS)
+
+static const char *const kind_names[] = {
+    [BASELINE_EMA]     = "ema",
+    [BASELINE_MEDIAN]  = "median",
+    [BASELINE_TRIMMED] = "trimmed",
+};
+
+#define NUM_KINDS NAMES_COUNT(kind_names)
+
+static int ms_to_samples(double ms, int rate_hz)
+{
+    double n = ms * rate_hz / 1000.0;
+    if (n < 1.0) return 1;
+    if (n > 1e9) return 1000000000;
+    return (int)lround(n);
+}
+
+// Sum of the `rank` lowest samples in the window (rank in the cursor's bin).
+static inline uint64_t cursor_sum(const BaselineCursor *c, uint32_t rank)
+{
+    return c->sum_below + (uint64_t)(rank - c->below) * (uint64_t)c->bin;
+}
+
+static inline void cursor_add(BaselineCursor *c, uint16_t code)
+{
+    if (code < c->bin)
+    {
+        c->below++;
+        c->sum_below += code;
+    }
+}
+
+static inline void cursor_remove(BaselineCursor *c, uint16_t code)
+{
+    if (code < c->bin)
+    {
+        c->below--;
+        c->sum_below -= code;
+    }
+}
+
+// Move the cursor to the bin holding `rank` (< b->count). Empty 64-code
+// blocks are stepped over whole, so a move costs at most a block or two
+// of bins plus the blocks in between.
+static void cursor_seek(const Baseline *b, BaselineCursor *c, uint32_t rank)
+{
+    const uint32_t *h = b->hist;
+    while (c->below > rank)
+    {
+        c->bin--;
+        while ((c->bin & (BLOCK_SIZE - 1)) == BLOCK_SIZE - 1
+               && b->blocks[c->bin >> BASELINE_BLOCK_BITS] == 0)
+        {
+            c->bin -= BLOCK_SIZE;
+        }
+        c->below     -= h[c->bin];
+        c->sum_below -= (uint64_t)h[c->bin] * (uint64_t)c->bin;
+    }
+    while (c->below + h[c->bin] <= rank)
+    {
+        c->below     += h[c->bin];
+        c->sum_below += (uint64_t)h[c->bin] * (uint64_t)c->bin;
+        c->bin++;
+        while ((c->bin & (BLOCK_SIZE - 1)) == 0
+               && b->blocks[c->bin >> BASELINE_BLOCK_BITS] == 0)
+        {
+            c->bin += BLOCK_SIZE;
+        }
+    }
+}
+
+static void window_push(Baseline *b, uint16_t code)
+{
+    if (code >= BASELINE_CODES) code = BASELINE_CODES - 1;
+
+    if (b->count == b->window)
+    {
+        uint16_t old = b->ring[b->head];
+        b->hist[old]--;
+        b->blocks[old >> BASELINE_BLOCK_BITS]--;
+        b->sum -= old;
+        cursor_remove(&b->lo, old);
+        cursor_remove(&b->hi, old);
+        b->count--;
+    }
+    b->ring[b->head] = code;
+    if (++b->head == b->window) b->head = 0;
+    b->hist[code]++;
+    b->blocks[code >> BASELINE_BLOCK_BITS]++;
+    b->sum += code;
+    cursor_add(&b->lo, code);
+    cursor_add(&b->hi, code);
+    b->count++;
+
+    uint32_t n = (uint32_t)b->count;
+    if (b->cfg.kind == BASELINE_MEDIAN)
+    {
+        // Mean of the two middle samples (equal ranks when n is odd).
+        uint32_t r_lo = (n - 1) / 2;
+        cursor_seek(b, &b->lo, r_lo);
+        cursor_seek(b, &b->hi, n / 2);
+        b->value_q16 = (int32_t)(((uint32_t)b->lo.bin + (uint32_t)b->hi.bin) << (DIP_Q16_SHIFT - 1));
+        return;
+    }
+
+    // Trimmed mean: the sum of the t lowest and of the n - t lowest
+    // samples come straight from the two cursors.
+    uint32_t t = (uint32_t)(((uint64_t)n * b->trim_q16) >> DIP_Q16_SHIFT);
+    if (t == 0)
+    {
+        b->value_q16 = (int32_t)(((int64_t)b->sum << DIP_Q16_SHIFT) / n);
+        return;
+    }
+    cursor_seek(b, &b->lo, t);
+    cursor_seek(b, &b->hi, n - t);
+    uint64_t kept = cursor_sum(&b->hi, n - t) - cursor_sum(&b->lo, t);
+    b->value_q16 = (int32_t)((int64_t)(kept << DIP_Q16_SHIFT) / (int64_t)(n - 2 * t));
+}
+
+bool Baseline_init(Baseline *b, const BaselineConfig *cfg, int rate_hz)
+{
+    if (!b || rate_hz <= 0) return false;
+
+    memset(b, 0, sizeof(*b));
+    b->cfg = cfg ? *cfg : Baseline_default();
+    if ((int)b->cfg.kind < 0 || (int)b->cfg.kind >= NUM_KINDS) b->cfg.kind = BASELINE_EMA;
+    if (b->cfg.trim < 0.0)  b->cfg.trim = 0.0;
+    if (b->cfg.trim > 0.45) b->cfg.trim = 0.45;
+    if (b->cfg.window_ms > BASELINE_MAX_WINDOW_MS) b->cfg.window_ms = BASELINE_MAX_WINDOW_MS;
+    b->trim_q16 = (uint32_t)lround(b->cfg.trim * DIP_Q16_ONE);
+
+    // Per-sample weight for a time constant of tau: 1 - exp(-T / tau).
+    double alpha = 1.0 - exp(-1000.0 / (b->cfg.tau_ms > 0.0 ? b->cfg.tau_ms : 1.0) / rate_hz);
+    b->alpha_q32 = llround(alpha * 4294967296.0);
+    if (b->alpha_q32 < 1) b->alpha_q32 = 1;
+
+    b->freeze_max = b->cfg.freeze_max_ms > 0.0 ? ms_to_samples(b->cfg.freeze_max_ms, rate_hz) : 0;
+
+    if (b->cfg.kind != BASELINE_EMA)
+    {
+        b->window = ms_to_samples(b->cfg.window_ms, rate_hz);
+        b->ring   = malloc((size_t)b->window * sizeof(*b->ring));
+        b->hist   = calloc(BASELINE_CODES, sizeof(*b->hist));
+        b->blocks = calloc(BASELINE_CODES >> BASELINE_BLOCK_BITS, sizeof(*b->blocks));
+        if (!b->ring || !b->hist || !b->blocks)
+        {
+            Baseline_free(b);
+            return false;
+        }
+    }
+    return true;
+}
+
+void Baseline_free(Baseline *b)
+{
+    if (!b) return;
+
+    free(b->ring);
+    free(b->hist);
+    free(b->blocks);
+    b->ring   = NULL;
+    b->hist   = NULL;
+    b->blocks = NULL;
+}
+
+bool Baseline_push(Baseline *b, uint16_t code, bool in_dip)
+{
+    if (b->cfg.freeze_in_dips && b->primed)
+    {
+        if (!in_dip)
+        {
+            b->freeze_run = 0;
+        }
+        else if (b->freeze_max == 0 || b->freeze_run < b->freeze_max)
+        {
+            b->freeze_run++;
+            b->frozen++;
+            return false;
+        }
+    }
+
+    if (b->cfg.kind != BASELINE_EMA)
+    {
+        window_push(b, code);
+    }
+    else if (!b->primed)
+    {
+        b->value_q16 = (int32_t)code << DIP_Q16_SHIFT;
+    }
+    else
+    {
+        // value += alpha * (v - value), rounded, in Q16.
+        int64_t d = ((int64_t)code << DIP_Q16_SHIFT) - b->value_q16;
+        b->value_q16 += (int32_t)((d * b->alpha_q32 + ((int64_t)1 << 31)) >> 32);
+    }
+    b->primed = true;
+    return true;
+}
+
+const char *Baseline_kindName(BaselineKind kind)
+{
+    return Names_lookup(kind_names, NUM_KINDS, (int)kind);
+}
+
+bool Baseline_parseKind(const char *name, BaselineKind *kind)
+{
+    int i;
+    if (!Names_parse(kind_names, NUM_KINDS, name, &i)) return false;
+    if (kind) *kind = (BaselineKind)i;
+    return true;
+}
+
+bool Baseline_parseArg(const char *arg, BaselineConfig *cfg)
+{
+    if (!arg || !cfg) return false;
+
+    if (!strncmp(arg, "--baseline=", 11))
+    {
+        if (!Baseline_parseKind(arg + 11, &cfg->kind))
+        {
+            fprintf(stderr, "WARN: unknown baseline '%s'; using %s\n", arg + 11,
+                    Baseline_kindName(cfg->kind));
+        }
+    }
+    else if (!strncmp(arg, "--baseline-tau-ms=", 18))    cfg->tau_ms = atof(arg + 18);
+    else if (!strncmp(arg, "--baseline-window-ms=", 21)) cfg->window_ms = atof(arg + 21);
+    else if (!strncmp(arg, "--baseline-trim=", 16))      cfg->trim = atof(arg + 16);
+    else if (!strcmp(arg, "--baseline-freeze"))          cfg->freeze_in_dips = true;
+    else if (!strncmp(arg, "--baseline-freeze=", 18))
+    {
+        cfg->freeze_in_dips = true;
+        cfg->freeze_max_ms  = atof(arg + 18);
+    }
+    else return false;
+    return true;
+}
+
+int Baseline_describe(const BaselineConfig *cfg, char *buf, size_t len)
+{
+    char freeze[48] = "";
+    if (cfg->freeze_in_dips)
+    {
+        if (cfg->freeze_max_ms > 0.0)
+        {
+            snprintf(freeze, sizeof(freeze), ", frozen in dips (max %.0f ms)", cfg->freeze_max_ms);
+        }
+        else
+        {
+            snprintf(freeze, sizeof(freeze), ", frozen in dips");
+        }
+    }
+
+    switch (cfg->kind)
+    {
+    case BASELINE_MEDIAN:
+        return snprintf(buf, len, "median over %.0f ms%s", cfg->window_ms, freeze);
+    case BASELINE_TRIMMED:
+        return snprintf(buf, len, "trimmed mean over %.0f ms (trim %.2f)%s",
+                        cfg->window_ms, cfg->trim, freeze);
+    default:
+        return snprintf(buf, len, "ema, tau %.0f ms%s", cfg->tau_ms, freeze);
+    }
+}
@@ -0,0 +1,252 @@
+#include "decimator.h"
+#include "names.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define CODE_MAX     4095
+#define COEF_SHIFT   15
+// FIR cutoff as a fraction of the output Nyquist frequency.
+#define FIR_CUTOFF   0.9
+// factor^order must leave room for a 12-bit code in 32 bits.
+#define CIC_MAX_GAIN (1u << 20)
+
+static const char *const kind_names[] = {
+    [DECIMATOR_NONE] = "none",
+    [DECIMATOR_CIC]  = "cic",
+    [DECIMATOR_FIR]  = "fir",
+};
+
+#define NUM_KINDS NAMES_COUNT(kind_names)
+
+static int clampi(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static uint32_t cic_gain(int factor, int order)
+{
+    uint64_t g = 1;
+    for (int s = 0; s < order; s++) g *= (uint64_t)factor;
+    return g > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)g;
+}
+
+// Fill in the factor and clamp the rest for an input rate. A factor of 1
+// needs no filter, so it always resolves to DECIMATOR_NONE.
+static DecimatorConfig resolve(const DecimatorConfig *cfg, int rate_hz)
+{
+    DecimatorConfig c = cfg ? *cfg : Decimator_default();
+    if ((int)c.kind < 0 || (int)c.kind >= NUM_KINDS) c.kind = DECIMATOR_NONE;
+
+    int factor = c.factor > 0 ? c.factor : rate_hz / DECIMATOR_AUTO_HZ;
+    c.factor = c.kind == DECIMATOR_NONE ? 1 : clampi(factor, 1, DECIMATOR_MAX_FACTOR);
+    if (c.factor == 1) c.kind = DECIMATOR_NONE;
+
+    c.cic_order = clampi(c.cic_order, 1, DECIMATOR_MAX_CIC_ORDER);
+    while (c.cic_order > 1 && cic_gain(c.factor, c.cic_order) > CIC_MAX_GAIN) c.cic_order--;
+    c.taps_per_phase = clampi(c.taps_per_phase, 2, DECIMATOR_MAX_TAPS_PER_PHASE);
+    return c;
+}
+
+// Tap k of a Hamming-windowed sinc with cutoff fc (cycles per sample).
+static double fir_tap(int k, int taps, double fc)
+{
+    double t = k - 0.5 * (taps - 1);
+    double v = t == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+    return v * (0.54 - 0.46 * cos(2.0 * M_PI * k / (taps - 1)));
+}
+
+// Q15 taps, scaled so they sum to exactly unity gain.
+static void fir_design(int32_t *coef, int taps, int factor)
+{
+    double fc = FIR_CUTOFF * 0.5 / factor;
+    double sum = 0.0;
+    for (int k = 0; k < taps; k++)
+    {
+        sum += fir_tap(k, taps, fc);
+    }
+    int32_t total = 0;
+    for (int k = 0; k < taps; k++)
+    {
+        coef[k] = (int32_t)lround(fir_tap(k, taps, fc) / sum * (1 << COEF_SHIFT));
+        total += coef[k];
+    }
+    coef[taps / 2] += (1 << COEF_SHIFT) - total;
+}
+
+static inline uint16_t clamp_code(int64_t v)
+{
+    return v < 0 ? 0 : v > CODE_MAX ? CODE_MAX : (uint16_t)v;
+}
+
+static inline int cic_push(Decimator *d, uint16_t x, uint16_t *out)
+{
+    int order = d->cfg.cic_order;
+    uint32_t v = x;
+    for (int s = 0; s < order; s++)
+    {
+        d->integ[s] += v;
+        v = d->integ[s];
+    }
+    if (++d->phase < d->cfg.factor) return 0;
+    d->phase = 0;
+
+    // Combs at the output rate; wrap-around in the integrators cancels.
+    for (int s = 0; s < order; s++)
+    {
+        uint32_t t = v;
+        v -= d->comb[s];
+        d->comb[s] = t;
+    }
+    *out = clamp_code(((uint64_t)v + d->gain / 2) / d->gain);
+    return 1;
+}
+
+static inline int fir_push(Decimator *d, uint16_t x, uint16_t *out)
+{
+    d->line[d->pos] = x;
+    d->line[d->pos + d->taps] = x;
+    if (++d->pos == d->taps) d->pos = 0;
+    if (++d->phase < d->cfg.factor) return 0;
+    d->phase = 0;
+
+    const uint16_t *w = d->line + d->pos;       // oldest .. newest
+    int32_t acc = 0;
+    for (int k = 0; k < d->taps; k++)
+    {
+        acc += d->coef[k] * (int32_t)w[k];
+    }
+    *out = clamp_code((acc + (1 << (COEF_SHIFT - 1))) >> COEF_SHIFT);
+    return 1;
+}
+
+// Start as if the input had always been `x`.
+static void prime(Decimator *d, uint16_t x)
+{
+    if (d->cfg.kind == DECIMATOR_FIR)
+    {
+        for (int k = 0; k < 2 * d->taps; k++) d->line[k] = x;
+        d->pos = 0;
+    }
+    else if (d->cfg.kind == DECIMATOR_CIC)
+    {
+        // order * factor inputs flush every stage; the phase ends at 0.
+        uint16_t dummy;
+        for (int i = 0; i < d->cfg.cic_order * d->cfg.factor; i++) cic_push(d, x, &dummy);
+    }
+    d->phase  = 0;
+    d->primed = true;
+}
+
+bool Decimator_init(Decimator *d, const DecimatorConfig *cfg, int rate_hz)
+{
+    if (!d || rate_hz <= 0) return false;
+
+    memset(d, 0, sizeof(*d));
+    d->cfg = resolve(cfg, rate_hz);
+    d->out_rate_hz = (double)rate_hz / d->cfg.factor;
+    d->gain = cic_gain(d->cfg.factor, d->cfg.cic_order);
+
+    if (d->cfg.kind == DECIMATOR_FIR)
+    {
+        d->taps = d->cfg.factor * d->cfg.taps_per_phase;
+        d->coef = malloc((size_t)d->taps * sizeof(*d->coef));
+        d->line = malloc((size_t)(2 * d->taps) * sizeof(*d->line));
+        if (!d->coef || !d->line)
+        {
+            Decimator_free(d);
+            return false;
+        }
+        fir_design(d->coef, d->taps, d->cfg.factor);
+    }
+    return true;
+}
+
+void Decimator_free(Decimator *d)
+{
+    if (!d) return;
+
+    free(d->coef);
+    free(d->line);
+    d->coef = NULL;
+    d->line = NULL;
+}
+
+int Decimator_process(Decimator *d, const uint16_t *in, int n, uint16_t *out)
+{
+    if (n <= 0) return 0;
+
+    if (d->cfg.kind == DECIMATOR_NONE)
+    {
+        memcpy(out, in, (size_t)n * sizeof(*out));
+        return n;
+    }
+    if (!d->primed) prime(d, in[0]);
+
+    int m = 0;
+    if (d->cfg.kind == DECIMATOR_FIR)
+    {
+        for (int i = 0; i < n; i++) m += fir_push(d, in[i], &out[m]);
+    }
+    else
+    {
+        for (int i = 0; i < n; i++) m += cic_push(d, in[i], &out[m]);
+    }
+    return m;
+}
+
+const char *Decimator_kindName(DecimatorKind kind)
+{
+    return Names_lookup(kind_names, NUM_KINDS, (int)kind);
+}
+
+bool Decimator_parseKind(const char *name, DecimatorKind *kind)
+{
+    int i;
+    if (!Names_parse(kind_names, NUM_KINDS, name, &i)) return false;
+    if (kind) *kind = (DecimatorKind)i;
+    return true;
+}
+
+bool Decimator_parseArg(const char *arg, DecimatorConfig *cfg)
+{
+    if (!arg || !cfg) return false;
+
+    if (!strncmp(arg, "--decim=", 8))
+    {
+        if (!Decimator_parseKind(arg + 8, &cfg->kind))
+        {
+            fprintf(stderr, "WARN: unknown decimator '%s'; using %s\n", arg + 8,
+                    Decimator_kindName(cfg->kind));
+        }
+    }
+    else if (!strncmp(arg, "--decim-factor=", 15)) cfg->factor = atoi(arg + 15);
+    else if (!strncmp(arg, "--decim-order=", 14))  cfg->cic_order = atoi(arg + 14);
+    else if (!strncmp(arg, "--decim-taps=", 13))   cfg->taps_per_phase = atoi(arg + 13);
+    else return false;
+    return true;
+}
+
+int Decimator_describe(const DecimatorConfig *cfg, int rate_hz, char *buf, size_t len)
+{
+    DecimatorConfig c = resolve(cfg, rate_hz > 0 ? rate_hz : 1);
+    double out_hz = (double)rate_hz / c.factor;
+
+    switch (c.kind)
+    {
+    case DECIMATOR_FIR:
+        return snprintf(buf, len, "fir x%d, %d taps (dips judged at %.0f Hz)",
+                        c.factor, c.factor * c.taps_per_phase, out_hz);
+    case DECIMATOR_CIC:
+        return snprintf(buf, len, "cic x%d, order %d (dips judged at %.0f Hz)",
+                        c.factor, c.cic_order, out_hz);
+    default:
+        return snprintf(buf, len, "none (dips judged at %.0f Hz)", out_hz);
+    }
+}
@@ -1,81 +1,321 @@
 #include "dip_detector.h"
 
-int Dip_count(const double *x, int n, double ave, const DipConfig *cfg)
+#include <math.h>
+#include <string.h>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DIP_SIMD_NEON 1
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define DIP_SIMD_AVX 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DIP_SIMD_SSE2 1
+#endif
+
+enum { ABOVE, BELOW_WAIT, BELOW_OK, GAP };
+
+// Block pre-pass: compare DIP_BLOCK samples at once into a bitmask
+// (bit k set when sample k matches), so long runs where the state machine
+// cannot change state are skipped without per-sample branches.
+#define DIP_BLOCK 8
+
+#if defined(DIP_SIMD_NEON)
+static inline unsigned mask_from_neon(uint64x2_t c0, uint64x2_t c1, uint64x2_t c2, uint64x2_t c3)
 {
-    if (!x || n <= 0 || !cfg) return 0;
+    static const uint64_t w[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint64x2_t m = vorrq_u64(
+        vorrq_u64(vandq_u64(c0, vld1q_u64(&w[0])), vandq_u64(c1, vld1q_u64(&w[2]))),
+        vorrq_u64(vandq_u64(c2, vld1q_u64(&w[4])), vandq_u64(c3, vld1q_u64(&w[6]))));
+    return (unsigned)vaddvq_u64(m);
+}
 
-    double trig = ave - cfg->trigger_delta;
-    double rel  = ave - cfg->release_delta;
+static inline unsigned block_mask_lt(const double *x, double t)
+{
+    float64x2_t vt = vdupq_n_f64(t);
+    return mask_from_neon(vcltq_f64(vld1q_f64(x),     vt), vcltq_f64(vld1q_f64(x + 2), vt),
+                          vcltq_f64(vld1q_f64(x + 4), vt), vcltq_f64(vld1q_f64(x + 6), vt));
+}
 
-    enum { ABOVE, BELOW_WAIT, BELOW_OK, GAP } 
-    state = ABOVE;
-    int run = 0; 
-    int gap = 0;
-    int dips = 0;
+static inline unsigned block_mask_ge(const double *x, double t)
+{
+    float64x2_t vt = vdupq_n_f64(t);
+    return mask_from_neon(vcgeq_f64(vld1q_f64(x),     vt), vcgeq_f64(vld1q_f64(x + 2), vt),
+                          vcgeq_f64(vld1q_f64(x + 4), vt), vcgeq_f64(vld1q_f64(x + 6), vt));
+}
+#elif defined(DIP_SIMD_AVX)
+static inline unsigned block_mask_lt(const double *x, double t)
+{
+    __m256d vt = _mm256_set1_pd(t);
+    unsigned lo = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(x),     vt, _CMP_LT_OQ));
+    unsigned hi = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(x + 4), vt, _CMP_LT_OQ));
+    return lo | (hi << 4);
+}
 
-    for (int i = 0; i < n; ++i) 
+static inline unsigned block_mask_ge(const double *x, double t)
+{
+    __m256d vt = _mm256_set1_pd(t);
+    unsigned lo = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(x),     vt, _CMP_GE_OQ));
+    unsigned hi = (unsigned)_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(x + 4), vt, _CMP_GE_OQ));
+    return lo | (hi << 4);
+}
+#elif defined(DIP_SIMD_SSE2)
+static inline unsigned block_mask_lt(const double *x, double t)
+{
+    __m128d vt = _mm_set1_pd(t);
+    unsigned m = 0;
+    for (int k = 0; k < DIP_BLOCK; k += 2)
+    {
+        m |= (unsigned)_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(x + k), vt)) << k;
+    }
+    return m;
+}
+
+static inline unsigned block_mask_ge(const double *x, double t)
+{
+    __m128d vt = _mm_set1_pd(t);
+    unsigned m = 0;
+    for (int k = 0; k < DIP_BLOCK; k += 2)
+    {
+        m |= (unsigned)_mm_movemask_pd(_mm_cmpge_pd(_mm_loadu_pd(x + k), vt)) << k;
+    }
+    return m;
+}
+#else
+static inline unsigned block_mask_lt(const double *x, double t)
+{
+    unsigned m = 0;
+    for (int k = 0; k < DIP_BLOCK; k++)
     {
-        double v = x[i];
+        m |= (unsigned)(x[k] < t) << k;
+    }
+    return m;
+}
 
-        if(state == ABOVE) 
+static inline unsigned block_mask_ge(const double *x, double t)
+{
+    unsigned m = 0;
+    for (int k = 0; k < DIP_BLOCK; k++)
+    {
+        m |= (unsigned)(x[k] >= t) << k;
+    }
+    return m;
+}
+#endif
+
+// Index of the first sample in [i, n) below t, or n if none.
+static int find_first_below(const double *x, int i, int n, double t)
+{
+    for (; i + DIP_BLOCK <= n; i += DIP_BLOCK)
+    {
+        unsigned m = block_mask_lt(x + i, t);
+        if (m) return i + __builtin_ctz(m);
+    }
+    for (; i < n; ++i)
+    {
+        if (x[i] < t) return i;
+    }
+    return n;
+}
+
+// Index of the first sample in [i, n) at or above t, or n if none.
+static int find_first_at_or_above(const double *x, int i, int n, double t)
+{
+    for (; i + DIP_BLOCK <= n; i += DIP_BLOCK)
+    {
+        unsigned m = block_mask_ge(x + i, t);
+        if (m) return i + __builtin_ctz(m);
+    }
+    for (; i < n; ++i)
+    {
+        if (x[i] >= t) return i;
+    }
+    return n;
+}
+
+// One step of the dip state machine, given how the sample compares with
+// the trigger and release levels (so the volts and code paths share it).
+// Returns 1 when a dip is counted.
+static inline int dip_step(DipStream *s, bool below_trig, bool at_or_above_rel)
+{
+    int counted = 0;
+
+    if(s->state == ABOVE) 
+    {
+        if (below_trig) 
+        {
+            s->state = BELOW_WAIT;
+            s->run = 1;
+        }
+    } 
+    else if (s->state == BELOW_WAIT) 
+    {
+        if (below_trig) 
         {
-            if (v < trig) 
+            ++ s->run;
+            if (s->run >= s->min_width) 
             {
-                state = BELOW_WAIT;
-                run = 1;
+                counted = 1;
+                s->state = BELOW_OK;
             }
         } 
-        else if (state == BELOW_WAIT) 
+        else 
+        {
+            s->run = 0;
+            s->state = ABOVE;
+        }
+    }
+    else if (s->state == BELOW_OK) 
+    {
+        if (at_or_above_rel) 
         {
-            if (v < trig) 
+            if (s->min_gap > 0) 
             {
-                ++ run;
-                if (run >= cfg->min_width) 
-                {
-                    ++dips;
-                    state = BELOW_OK;
-                }
-            } 
+                s->gap = s->min_gap;
+            }
             else 
             {
-                run = 0;
-                state = ABOVE;
+                s->gap = 0;
             }
-        }
-        else if (state == BELOW_OK) 
-        {
-            if (v >= rel) 
+
+            if (s->gap > 0) 
             {
-                if (cfg->min_gap > 0) 
-                {
-                    gap = cfg->min_gap;
-                }
-                else 
-                {
-                    gap = 0;
-                }
-
-                if (gap > 0) 
-                {
-                    state = GAP;
-                }
-                else 
-                {
-                    state = ABOVE;
-                }
+                s->state = GAP;
             }
-
-        } 
-        else if (state == GAP) 
-        {
-            gap -= 1;
-            if (gap <= 0) 
+            else 
             {
-                state = ABOVE;
+                s->state = ABOVE;
             }
         }
 
+    } 
+    else if (s->state == GAP) 
+    {
+        s->gap -= 1;
+        if (s->gap <= 0) 
+        {
+            s->state = ABOVE;
+        }
+    }
+    return counted;
+}
 
+int Dip_count(const double *x, int n, double ave, const DipConfig *cfg, double rate_hz)
+{
+    if (!x || n <= 0 || !cfg) return 0;
+
+    double trig = ave - cfg->trigger_delta;
+    double rel  = ave - cfg->release_delta;
+
+    DipStream s;
+    Dip_streamInit(&s, cfg, rate_hz);
+    int dips = 0;
+
+    int i = 0;
+    while (i < n) 
+    {
+        // ABOVE only reacts to v < trig and BELOW_OK only to v >= rel:
+        // jump straight to the next sample that can change the state.
+        if (s.state == ABOVE) 
+        {
+            i = find_first_below(x, i, n, trig);
+        }
+        else if (s.state == BELOW_OK) 
+        {
+            i = find_first_at_or_above(x, i, n, rel);
+        }
+        if (i >= n) 
+        {
+            break;
+        }
+        dips += dip_step(&s, x[i] < trig, x[i] >= rel);
+        ++i;
     }
     return dips;
 }
+
+int Dip_countScalar(const double *x, int n, double ave, const DipConfig *cfg, double rate_hz)
+{
+    if (!x || n <= 0 || !cfg) return 0;
+
+    double trig = ave - cfg->trigger_delta;
+    double rel  = ave - cfg->release_delta;
+
+    DipStream s;
+    Dip_streamInit(&s, cfg, rate_hz);
+    int dips = 0;
+
+    for (int i = 0; i < n; ++i) 
+    {
+        dips += dip_step(&s, x[i] < trig, x[i] >= rel);
+    }
+    return dips;
+}
+
+// Samples spanning `ms` at rate_hz, rounded up (a dip must last the
+// whole width); tiny excesses from the ms/Hz round trip are ignored.
+static int ms_to_samples(double ms, double rate_hz)
+{
+    double n = ms * rate_hz / 1000.0;
+    if (n <= 0.0) return 0;
+    if (n > 1e9) return 1000000000;
+    return (int)ceil(n - 1e-6);
+}
+
+void Dip_streamInit(DipStream *s, const DipConfig *cfg, double rate_hz)
+{
+    if (!s) return;
+
+    memset(s, 0, sizeof(*s));
+    s->cfg   = cfg ? *cfg : Dip_default();
+    s->state = ABOVE;
+    if (rate_hz <= 0.0) rate_hz = 1000.0;
+    s->min_width = ms_to_samples(s->cfg.min_width_ms, rate_hz);
+    s->min_gap   = ms_to_samples(s->cfg.min_gap_ms, rate_hz);
+    if (s->min_width < 1) s->min_width = 1;
+}
+
+int Dip_streamPush(DipStream *s, double v, double ave)
+{
+    int counted = dip_step(s, v < ave - s->cfg.trigger_delta, v >= ave - s->cfg.release_delta);
+    s->total += counted;
+    return counted;
+}
+
+bool Dip_streamInDip(const DipStream *s)
+{
+    return s->state == BELOW_WAIT || s->state == BELOW_OK;
+}
+
+void Dip_streamSetCodeScale(DipStream *s, double volts_per_code)
+{
+    if (!s || volts_per_code <= 0.0) return;
+
+    s->trigger_q16 = (int32_t)lround(s->cfg.trigger_delta / volts_per_code * DIP_Q16_ONE);
+    s->release_q16 = (int32_t)lround(s->cfg.release_delta / volts_per_code * DIP_Q16_ONE);
+}
+
+int Dip_streamPushCode(DipStream *s, uint16_t code, int32_t ave_q16)
+{
+    int32_t v_q16 = (int32_t)code << DIP_Q16_SHIFT;
+    int counted = dip_step(s, v_q16 < ave_q16 - s->trigger_q16, v_q16 >= ave_q16 - s->release_q16);
+    s->total += counted;
+    return counted;
+}
+
+int Dip_countCodes(const uint16_t *x, int n, int32_t ave_q16, const DipConfig *cfg,
+                   double rate_hz, double volts_per_code)
+{
+    if (!x || n <= 0 || !cfg) return 0;
+
+    DipStream s;
+    Dip_streamInit(&s, cfg, rate_hz);
+    Dip_streamSetCodeScale(&s, volts_per_code);
+
+    for (int i = 0; i < n; ++i) 
+    {
+        Dip_streamPushCode(&s, x[i], ave_q16);
+    }
+    return (int)s.total;
+}
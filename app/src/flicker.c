@@ -0,0 +1,348 @@
+#include "flicker.h"
+#include "names.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Goertzel probes either side of the expected frequency, half a bin apart.
+#define GOERTZEL_HALF_BANK 8
+#define GOERTZEL_PROBES    (2 * GOERTZEL_HALF_BANK + 1)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const char *const method_names[] = {
+    [FLICKER_OFF]      = "off",
+    [FLICKER_GOERTZEL] = "goertzel",
+    [FLICKER_FFT]      = "fft",
+};
+
+#define NUM_METHODS NAMES_COUNT(method_names)
+
+static FlickerMethod method = FLICKER_OFF;
+
+// Plan: N-point real FFT done as an N/2-point complex FFT. All buffers are
+// sized once in Flicker_init.
+static int       fft_n   = 0;       // N, a power of two
+static double   *work    = NULL;    // N windowed samples, zero-padded
+static double   *z_re    = NULL;    // N/2 complex points
+static double   *z_im    = NULL;
+static double   *tw_cos  = NULL;    // cos/sin(2 pi k / N), k < N/2
+static double   *tw_sin  = NULL;
+static uint32_t *bitrev  = NULL;    // N/2 entries
+static double   *mag     = NULL;    // N/2 + 1 bins
+
+static void plan_free(void)
+{
+    free(work);
+    free(z_re);
+    free(z_im);
+    free(tw_cos);
+    free(tw_sin);
+    free(bitrev);
+    free(mag);
+    work = z_re = z_im = tw_cos = tw_sin = mag = NULL;
+    bitrev = NULL;
+    fft_n = 0;
+}
+
+static bool plan_alloc(int max_samples)
+{
+    int n = 16;
+    int bits = 0;
+    while (n < max_samples) n <<= 1;
+    for (int m = n / 2; m > 1; m >>= 1) bits++;
+
+    int half = n / 2;
+    work   = calloc((size_t)n, sizeof(*work));
+    z_re   = malloc((size_t)half * sizeof(*z_re));
+    z_im   = malloc((size_t)half * sizeof(*z_im));
+    tw_cos = malloc((size_t)half * sizeof(*tw_cos));
+    tw_sin = malloc((size_t)half * sizeof(*tw_sin));
+    bitrev = malloc((size_t)half * sizeof(*bitrev));
+    mag    = malloc((size_t)(half + 1) * sizeof(*mag));
+    if (!work || !z_re || !z_im || !tw_cos || !tw_sin || !bitrev || !mag)
+    {
+        plan_free();
+        return false;
+    }
+    fft_n = n;
+
+    for (int k = 0; k < half; k++)
+    {
+        tw_cos[k] = cos(2.0 * M_PI * k / n);
+        tw_sin[k] = sin(2.0 * M_PI * k / n);
+    }
+    for (uint32_t i = 0; i < (uint32_t)half; i++)
+    {
+        uint32_t r = 0;
+        for (int b = 0; b < bits; b++)
+        {
+            r |= ((i >> b) & 1u) << (bits - 1 - b);
+        }
+        bitrev[i] = r;
+    }
+    return true;
+}
+
+// In-place iterative radix-2 FFT of the N/2 points in z_re/z_im.
+static void fft_complex(void)
+{
+    int m = fft_n / 2;
+    for (int i = 0; i < m; i++)
+    {
+        int j = (int)bitrev[i];
+        if (i < j)
+        {
+            double t = z_re[i]; z_re[i] = z_re[j]; z_re[j] = t;
+            t = z_im[i]; z_im[i] = z_im[j]; z_im[j] = t;
+        }
+    }
+    for (int len = 2; len <= m; len <<= 1)
+    {
+        int half   = len / 2;
+        int stride = fft_n / len;   // W_len^k = W_N^(k * N / len)
+        for (int i = 0; i < m; i += len)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                double wr =  tw_cos[k * stride];
+                double wi = -tw_sin[k * stride];
+                int a = i + k, b = a + half;
+                double tr = wr * z_re[b] - wi * z_im[b];
+                double ti = wr * z_im[b] + wi * z_re[b];
+                z_re[b] = z_re[a] - tr;
+                z_im[b] = z_im[a] - ti;
+                z_re[a] += tr;
+                z_im[a] += ti;
+            }
+        }
+    }
+}
+
+// Magnitudes of the N-point real FFT of work[] into mag[0..N/2]: pack the
+// even/odd samples as one complex sequence, transform, then split.
+static void fft_real_magnitudes(void)
+{
+    int m = fft_n / 2;
+    for (int k = 0; k < m; k++)
+    {
+        z_re[k] = work[2 * k];
+        z_im[k] = work[2 * k + 1];
+    }
+    fft_complex();
+
+    mag[0] = fabs(z_re[0] + z_im[0]);
+    mag[m] = fabs(z_re[0] - z_im[0]);
+    for (int k = 1; k < m; k++)
+    {
+        double ar = z_re[k],     ai = z_im[k];
+        double br = z_re[m - k], bi = z_im[m - k];
+        double er = 0.5 * (ar + br), ei = 0.5 * (ai - bi);     // even part
+        double orr = 0.5 * (ai + bi), oi = -0.5 * (ar - br);   // odd part
+        double c = tw_cos[k], s = tw_sin[k];                   // W_N^k = c - i s
+        double xr = er + c * orr + s * oi;
+        double xi = ei + c * oi - s * orr;
+        mag[k] = sqrt(xr * xr + xi * xi);
+    }
+}
+
+// Offset of the true peak from the middle of three magnitudes (-0.5..0.5).
+static double parabolic_offset(double a, double b, double c)
+{
+    double den = a - 2.0 * b + c;
+    if (den >= 0.0) return 0.0;
+    double d = 0.5 * (a - c) / den;
+    if (d < -0.5) d = -0.5;
+    if (d >  0.5) d =  0.5;
+    return d;
+}
+
+// Height of that interpolated peak.
+static double parabolic_peak(double a, double b, double c, double d)
+{
+    return b - 0.25 * (a - c) * d;
+}
+
+// Resample the primary channel onto a uniform grid `step_us` apart from its
+// first timestamp, interpolating linearly between stored samples, into
+// work[]. The transforms assume evenly spaced input; the stored samples
+// are not always (a dropped tick leaves a gap, and a timestamp is only
+// known to the microsecond). Returns the grid points written.
+static int resample(const Sampler_snapshot_t *snap, double step_us)
+{
+    const sample_t *x = snap->samples;
+    const uint32_t *t = snap->offsets_us;
+    int n = snap->size;
+    double t_end = t[n - 1];
+    int src = 0;
+    int m = 0;
+    for (; m < fft_n; m++)
+    {
+        double tm = t[0] + m * step_us;
+        if (tm > t_end) break;
+        while (src + 1 < n && t[src + 1] <= tm) src++;
+        if (src + 1 >= n)
+        {
+            work[m] = Sampler_toVolts(x[src]);
+            continue;
+        }
+        double a = (tm - t[src]) / (double)(t[src + 1] - t[src]);
+        work[m] = (1.0 - a) * Sampler_toVolts(x[src]) + a * Sampler_toVolts(x[src + 1]);
+    }
+    return m;
+}
+
+static double goertzel(const double *x, int n, double freq_hz, double rate_hz)
+{
+    double coeff = 2.0 * cos(2.0 * M_PI * freq_hz / rate_hz);
+    double s1 = 0.0, s2 = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+        double s0 = x[i] + coeff * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    double power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+    return power > 0.0 ? sqrt(power) : 0.0;
+}
+
+static void analyze_goertzel(int n, double rate_hz, double wsum, Flicker_result_t *out)
+{
+    if (out->expected_hz <= 0.0) return;
+
+    double step = 0.5 * rate_hz / n;
+    double nyquist = 0.5 * rate_hz;
+    double m[GOERTZEL_PROBES];
+    int best = -1;
+    for (int j = 0; j < GOERTZEL_PROBES; j++)
+    {
+        double f = out->alias_hz + (j - GOERTZEL_HALF_BANK) * step;
+        m[j] = (f > 0.0 && f < nyquist) ? goertzel(work, n, f, rate_hz) : 0.0;
+        if (best < 0 || m[j] > m[best]) best = j;
+    }
+    double peak = m[best];
+    double d = 0.0;
+    if (best > 0 && best < GOERTZEL_PROBES - 1)
+    {
+        d    = parabolic_offset(m[best - 1], m[best], m[best + 1]);
+        peak = parabolic_peak(m[best - 1], m[best], m[best + 1], d);
+    }
+    out->freq_hz     = out->alias_hz + (best - GOERTZEL_HALF_BANK + d) * step;
+    out->amplitude_v = 2.0 * peak / wsum;
+}
+
+static void analyze_fft(int n, double rate_hz, double wsum, Flicker_result_t *out)
+{
+    memset(work + n, 0, (size_t)(fft_n - n) * sizeof(*work));
+    fft_real_magnitudes();
+
+    int half  = fft_n / 2;
+    int first = (int)ceil(FLICKER_MIN_HZ * fft_n / rate_hz);
+    if (first < 1) first = 1;
+    int best = first;
+    for (int k = first + 1; k < half; k++)
+    {
+        if (mag[k] > mag[best]) best = k;
+    }
+    double peak = mag[best];
+    double d = 0.0;
+    if (best > 1)
+    {
+        d    = parabolic_offset(mag[best - 1], mag[best], mag[best + 1]);
+        peak = parabolic_peak(mag[best - 1], mag[best], mag[best + 1], d);
+    }
+    out->freq_hz     = (best + d) * rate_hz / fft_n;
+    out->amplitude_v = 2.0 * peak / wsum;
+}
+
+bool Flicker_init(FlickerMethod m, int max_samples)
+{
+    Flicker_cleanup();
+    if ((int)m <= FLICKER_OFF || (int)m >= NUM_METHODS || max_samples < 16)
+    {
+        return m == FLICKER_OFF;
+    }
+    if (!plan_alloc(max_samples))
+    {
+        return false;
+    }
+    method = m;
+    return true;
+}
+
+void Flicker_cleanup(void)
+{
+    plan_free();
+    method = FLICKER_OFF;
+}
+
+FlickerMethod Flicker_getMethod(void)
+{
+    return method;
+}
+
+bool Flicker_analyze(const Sampler_snapshot_t *snap, double expected_hz, Flicker_result_t *out)
+{
+    if (!out) return false;
+    memset(out, 0, sizeof(*out));
+    out->expected_hz = expected_hz;
+    if (method == FLICKER_OFF || !snap || !snap->samples || snap->size < 16) return false;
+
+    // Place the samples by their timestamps on a grid at the snapshot's
+    // rate (or, failing that, the timestamps' mean rate).
+    double span_us = (double)snap->offsets_us[snap->size - 1] - (double)snap->offsets_us[0];
+    double rate_hz = snap->rate_hz > 0 ? (double)snap->rate_hz
+                   : span_us > 0.0 ? (snap->size - 1) * 1e6 / span_us : 0.0;
+    if (rate_hz <= 0.0) return false;
+    int n = resample(snap, 1e6 / rate_hz);
+    if (n < 16) return false;
+    out->rate_hz = rate_hz;
+    if (expected_hz > 0.0)
+    {
+        double alias = fabs(expected_hz - rate_hz * floor(expected_hz / rate_hz + 0.5));
+        out->alias_hz = alias;
+        out->aliased  = expected_hz > 0.5 * rate_hz;
+    }
+
+    // Remove the DC level and apply a Hann window.
+    double mean = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+        mean += work[i];
+    }
+    mean /= n;
+    double wsum = 0.0;
+    double dphi = 2.0 * M_PI / (n - 1);
+    for (int i = 0; i < n; i++)
+    {
+        double w = 0.5 - 0.5 * cos(dphi * i);
+        work[i] = (work[i] - mean) * w;
+        wsum += w;
+    }
+
+    if (method == FLICKER_GOERTZEL) analyze_goertzel(n, rate_hz, wsum, out);
+    else                            analyze_fft(n, rate_hz, wsum, out);
+
+    if (out->amplitude_v < FLICKER_MIN_AMPLITUDE_V || out->freq_hz < FLICKER_MIN_HZ)
+    {
+        out->freq_hz = 0.0;
+    }
+    return true;
+}
+
+const char *Flicker_methodName(FlickerMethod m)
+{
+    return Names_lookup(method_names, NUM_METHODS, (int)m);
+}
+
+bool Flicker_parseMethod(const char *name, FlickerMethod *m)
+{
+    int i;
+    if (!Names_parse(method_names, NUM_METHODS, name, &i)) return false;
+    if (m) *m = (FlickerMethod)i;
+    return true;
+}
@@ -0,0 +1,339 @@
+#include "journal.h"
+#include "sampler.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// How often the journal thread looks for newly completed seconds.
+#define JOURNAL_POLL_MS 200
+
+static JournalConfig config;
+static char dir_path[PATH_MAX];
+
+static pthread_t thr;
+static bool thr_started = false;
+static bool stop_requested = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+// Current segment (journal thread only, once started).
+static int seg_fd = -1;
+static uint8_t *seg_map = NULL;
+static int seg_index = 0;
+static int first_index = 0;         // oldest segment written by this run
+
+static long long next_second = 0;   // next second to copy
+
+static _Atomic long long seconds_written = 0;
+static _Atomic long long seconds_missed  = 0;
+static _Atomic int current_segment = 0;
+
+static void segment_path(char *out, size_t len, int index)
+{
+    snprintf(out, len, "%s/journal-%06d.seg", dir_path, index);
+}
+
+// Continue numbering after any segments already in the directory.
+static int next_free_index(void)
+{
+    int next = 0;
+    DIR *d = opendir(dir_path);
+    if (!d) return 0;
+
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+    {
+        int idx;
+        if (sscanf(e->d_name, "journal-%d.seg", &idx) == 1 && idx >= next)
+        {
+            next = idx + 1;
+        }
+    }
+    closedir(d);
+    return next;
+}
+
+static void segment_close(void)
+{
+    if (seg_map)
+    {
+        msync(seg_map, config.segment_bytes, MS_ASYNC);
+        munmap(seg_map, config.segment_bytes);
+        seg_map = NULL;
+    }
+    if (seg_fd >= 0)
+    {
+        close(seg_fd);
+        seg_fd = -1;
+    }
+}
+
+static bool segment_open(int index)
+{
+    char path[PATH_MAX + 32];
+    segment_path(path, sizeof(path), index);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "journal: open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    // Reserve the blocks now so the mapping never hits ENOSPC (SIGBUS).
+    int err = posix_fallocate(fd, 0, (off_t)config.segment_bytes);
+    if (err != 0)
+    {
+        fprintf(stderr, "journal: preallocate %s: %s\n", path, strerror(err));
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    void *map = mmap(NULL, config.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "journal: mmap %s: %s\n", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    seg_fd    = fd;
+    seg_map   = map;
+    seg_index = index;
+    atomic_store(&current_segment, index);
+
+    journal_segment_header_t *h = (journal_segment_header_t *)seg_map;
+    memset(h, 0, sizeof(*h));
+    h->magic          = JOURNAL_SEGMENT_MAGIC;
+    h->version        = JOURNAL_VERSION;
+    h->header_bytes   = sizeof(*h);
+    h->segment_index  = (uint32_t)index;
+    h->sample_rate_hz = (uint32_t)Sampler_getSampleRate();
+    h->segment_bytes  = config.segment_bytes;
+    h->used_bytes     = (sizeof(*h) + 7) & ~(size_t)7;
+    h->record_count   = 0;
+    h->volts_per_code = Sampler_getVoltsPerCode();
+
+    // Rotation: drop the oldest segment this run wrote beyond the limit.
+    if (config.max_segments > 0 && index - first_index >= config.max_segments)
+    {
+        char old[PATH_MAX + 32];
+        segment_path(old, sizeof(old), index - config.max_segments);
+        unlink(old);
+    }
+    return true;
+}
+
+// Copy one second into the mapping, rotating first if it does not fit.
+// After a failed rotation there is no segment (seg_map is NULL) until
+// drain() manages to open the next one.
+static bool append_second(const Sampler_snapshot_t *snap)
+{
+    if (!seg_map) return false;
+
+    size_t bytes = JOURNAL_RECORD_BYTES(snap->size);
+    journal_segment_header_t *h = (journal_segment_header_t *)seg_map;
+    if (h->used_bytes + bytes > config.segment_bytes)
+    {
+        segment_close();
+        if (!segment_open(seg_index + 1))
+        {
+            return false;
+        }
+        h = (journal_segment_header_t *)seg_map;
+    }
+    if (h->used_bytes + bytes > config.segment_bytes)
+    {
+        return false;   // one second larger than a whole segment
+    }
+
+    uint8_t *rec = seg_map + h->used_bytes;
+    journal_record_header_t rh = {
+        .magic        = JOURNAL_RECORD_MAGIC,
+        .record_bytes = (uint32_t)bytes,
+        .second       = snap->second,
+        .start_ns     = snap->start_ns,
+        .count        = (uint32_t)snap->size,
+        .dips         = (uint32_t)snap->dips,
+    };
+    memcpy(rec, &rh, sizeof(rh));
+
+    uint16_t *codes = (uint16_t *)(rec + JOURNAL_CODES_OFFSET);
+#ifdef SAMPLER_FIXED_POINT
+    memcpy(codes, snap->samples, (size_t)snap->size * sizeof(uint16_t));
+#else
+    for (int i = 0; i < snap->size; i++)
+    {
+        codes[i] = Sampler_toCode(snap->samples[i]);
+    }
+#endif
+    memcpy(rec + JOURNAL_OFFSETS_OFFSET(snap->size), snap->offsets_us,
+           (size_t)snap->size * sizeof(uint32_t));
+
+    // Publish the record only once it is complete.
+    __atomic_store_n(&h->record_count, h->record_count + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->used_bytes, h->used_bytes + bytes, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Give up on the seconds up to `latest`: there is no segment to put them in.
+static void skip_to(long long latest)
+{
+    atomic_fetch_add(&seconds_missed, latest - next_second + 1);
+    next_second = latest + 1;
+}
+
+// Copy every second completed since the last pass that is still in the ring.
+static void drain(void)
+{
+    long long oldest, latest;
+    Sampler_getHistoryRange(&oldest, &latest);
+    if (latest < 0 || next_second > latest) return;
+
+    if (next_second < oldest)
+    {
+        atomic_fetch_add(&seconds_missed, oldest - next_second);
+        next_second = oldest;
+    }
+    // A rotation failed earlier: retry once per pass with new seconds.
+    if (!seg_map && !segment_open(seg_index + 1))
+    {
+        skip_to(latest);
+        return;
+    }
+    for (; next_second <= latest; next_second++)
+    {
+        Sampler_snapshot_t snap;
+        if (!Sampler_acquireSecond(next_second, &snap))
+        {
+            atomic_fetch_add(&seconds_missed, 1);
+            continue;
+        }
+        bool ok = append_second(&snap);
+        Sampler_releaseHistory(&snap);
+        if (ok)
+        {
+            atomic_fetch_add(&seconds_written, 1);
+        }
+        else if (!seg_map)
+        {
+            skip_to(latest);     // rotation failed: this and the rest
+            return;
+        }
+        else
+        {
+            atomic_fetch_add(&seconds_missed, 1);
+        }
+    }
+}
+
+static void *worker(void *unused)
+{
+    (void)unused;
+
+    pthread_mutex_lock(&lock);
+    while (!stop_requested)
+    {
+        pthread_mutex_unlock(&lock);
+        drain();
+        pthread_mutex_lock(&lock);
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += JOURNAL_POLL_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        if (!stop_requested)
+        {
+            pthread_cond_timedwait(&wake, &lock, &until);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    // Catch the final seconds before the sampler goes away.
+    drain();
+    return NULL;
+}
+
+bool Journal_start(const JournalConfig *cfg)
+{
+    if (!cfg || !cfg->dir || thr_started) return false;
+
+    config = *cfg;
+    if (config.segment_bytes == 0)
+    {
+        config.segment_bytes = JOURNAL_DEFAULT_SEGMENT_BYTES;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    if (page > 0)
+    {
+        config.segment_bytes = (config.segment_bytes + (size_t)page - 1) & ~((size_t)page - 1);
+    }
+    snprintf(dir_path, sizeof(dir_path), "%s", cfg->dir);
+    config.dir = dir_path;
+
+    if (mkdir(dir_path, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "journal: mkdir %s: %s\n", dir_path, strerror(errno));
+        return false;
+    }
+
+    first_index = next_free_index();
+    if (!segment_open(first_index))
+    {
+        return false;
+    }
+
+    // Start with the seconds that complete from now on.
+    long long latest;
+    Sampler_getHistoryRange(NULL, &latest);
+    next_second = latest + 1;
+    atomic_store(&seconds_written, 0);
+    atomic_store(&seconds_missed, 0);
+
+    stop_requested = false;
+    if (pthread_create(&thr, NULL, worker, NULL) != 0)
+    {
+        segment_close();
+        return false;
+    }
+    thr_started = true;
+    return true;
+}
+
+void Journal_stop(void)
+{
+    if (!thr_started) return;
+
+    pthread_mutex_lock(&lock);
+    stop_requested = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thr, NULL);
+    thr_started = false;
+    segment_close();
+}
+
+void Journal_getStats(Journal_stats_t *stats)
+{
+    if (!stats) return;
+
+    stats->seconds_written = atomic_load(&seconds_written);
+    stats->seconds_missed  = atomic_load(&seconds_missed);
+    stats->segment_index   = atomic_load(&current_segment);
+}
@@ -7,6 +7,8 @@
 #include "dip_detector.h"
 #include "periodTimer.h"
 #include "udp.h"
+#include "journal.h"
+#include "flicker.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -60,26 +62,91 @@ static void stats(const double *x, int n, double *out_mean, double *out_min, dou
 }
 
 
-static void print_line1(int n, int cur_hz, double avg, int dips)
+static void print_line1(int n, int cur_hz, double avg, int dips, const Period_statistics_t *pps,
+                        const Sampler_timing_t *pt)
 {
-    Period_statistics_t ps = {0};
-    Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_LIGHT, &ps);
     printf("#Smpl/s = %4d Flash @ %3dHz avg = %5.3fV dips = %3d "
            "Smpl ms[%6.3f, %6.3f] avg %6.3f/%4d\n",
            n, cur_hz, avg, dips,
-           ps.minPeriodInMs, ps.maxPeriodInMs,
-           ps.avgPeriodInMs, ps.numSamples);
+           pps->minPeriodInMs, pps->maxPeriodInMs,
+           pps->avgPeriodInMs, pps->numSamples);
+    printf("    jitter ms: p50 %6.3f p90 %6.3f p99 %6.3f p99.9 %6.3f sd %6.3f\n",
+           pps->p50PeriodInMs, pps->p90PeriodInMs, pps->p99PeriodInMs,
+           pps->p999PeriodInMs, pps->stdDevPeriodInMs);
+    printf("    ticks: latency avg %6.1fus max %6.1fus late %lld dropped %lld\n",
+           pt->avg_latency_us, pt->max_latency_us, pt->late_ticks, pt->dropped_ticks);
 }
 
-static void print_line2_samples(const double *x, int n)
+// Dominant flicker the sensor saw, against the commanded LED frequency.
+static void print_line_flicker(const Flicker_result_t *fr)
 {
-    if (!x || n <= 0) 
+    if (fr->freq_hz > 0.0)
+    {
+        printf("    flicker: %7.2f Hz %5.3fV", fr->freq_hz, fr->amplitude_v);
+    }
+    else
+    {
+        printf("    flicker:    none       ");
+    }
+    printf(" (LED %.0f Hz", fr->expected_hz);
+    if (fr->aliased)
+    {
+        printf(", aliased to %.1f Hz at %.0f Hz sampling", fr->alias_hz, fr->rate_hz);
+    }
+    printf(")\n");
+}
+
+// Average and dips of each channel after the primary one.
+static void print_line_channels(const Sampler_snapshot_t *hist)
+{
+    for (int k = 1; k < hist->num_channels; k++)
+    {
+        printf("    ch%d: avg = %5.3fV dips = %3d\n", Sampler_getChannelId(k),
+               Sampler_getChannelAverage(k), hist->channel_dips[k]);
+    }
+}
+
+// Parse a comma-separated channel list ("0,3,5"); returns the count, or
+// -1 if it is malformed or too long.
+static int parse_channels(const char *s, int *out, int max)
+{
+    int n = 0;
+    while (*s)
+    {
+        char *end;
+        long v = strtol(s, &end, 10);
+        if (end == s || n >= max || (*end != ',' && *end != '\0')) return -1;
+        out[n++] = (int)v;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+// First sample taken at or after `t_us` (offsets are non-decreasing).
+static int index_at_time(const uint32_t *t, int n, double t_us)
+{
+    int lo = 0, hi = n - 1;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (t[mid] < t_us) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Print up to 10 samples spread evenly over the second by their
+// timestamps, as index:volts.
+static void print_line2_samples(const sample_t *x, const uint32_t *t_us, int n)
+{
+    if (!x || !t_us || n <= 0) 
     { 
         puts(" (no samples)"); 
         return; 
     }
 
     int show = (n < 10) ? n : 10;
+    double span_us = (double)t_us[n - 1] - (double)t_us[0];
     putchar(' ');
     for (int i = 0; i < show; i++) 
     {
@@ -90,13 +157,10 @@ static void print_line2_samples(const double *x, int n)
         } 
         else 
         {
-        
-            double pos = (double)i * (double)(n - 1) / (double)(show - 1);
-            idx = (int)llround(pos);
-            if (idx < 0) idx = 0;
-            if (idx >= n) idx = n - 1;
+            double at = (double)t_us[0] + (double)i * span_us / (double)(show - 1);
+            idx = index_at_time(t_us, n, at);
         }
-        printf("%3d:%0.3f%s", idx, x[idx], (i + 1 < show) ? " " : "\n");
+        printf("%3d:%0.3f%s", idx, Sampler_toVolts(x[idx]), (i + 1 < show) ? " " : "\n");
     }
 }
 
@@ -120,8 +184,22 @@ int main(int argc, char **argv)
 "  --step=<K>                       Hz per detent (default: 1)\n"
 "  --dip-trig=<V>                   Trigger delta (V below EMA)\n"
 "  --dip-rel=<V>                    Release delta (V below EMA)\n"
-"  --dip-width=<N>                  Min width (samples)\n"
-"  --dip-gap=<N>                    Min gap (samples)\n",
+"  --dip-width-ms=<ms>              Min width (default: 2)\n"
+"  --dip-gap-ms=<ms>                Min gap (default: 1)\n"
+"  --rate=<Hz>                      Sample rate 1000..20000 (default: 1000)\n"
+"  --channels=<a,b,...>            ADC channels to sample together; the first\n"
+"                                   is the primary (default: <adc_channel>)\n"
+BASELINE_USAGE
+DECIMATOR_USAGE
+"  --flicker=<goertzel|fft|off>     Flicker frequency estimator (default: goertzel)\n"
+"  --history=<s>                    Seconds of history kept (default: 60)\n"
+"  --journal=<dir>                  Record every second to mmap'd segments in <dir>\n"
+"  --journal-seg-mb=<N>             Journal segment size in MiB (default: 16)\n"
+"  --journal-keep=<N>               Segments kept on disk (default: all)\n"
+"  --rt-prio=<N>                    Sampler SCHED_FIFO priority 1..99 (default: off)\n"
+"  --rt-cpu=<N>                     Pin the sampler to CPU N (default: any)\n"
+"  --bg-nice=<N>                    Niceness for UDP and printing (default: 0)\n"
+"  --mlock                          Lock all memory in RAM (mlockall)\n",
             argv[0]);
         return 2;
     }
@@ -135,12 +213,23 @@ int main(int argc, char **argv)
     int fmin = 0, fmax = 500;
     int cur_hz = 10, duty = 50, step_hz = 1;
     const int poll_ms = 10;
+    int rate_hz = SAMPLER_DEFAULT_RATE_HZ;
+    int history_s = SAMPLER_DEFAULT_HISTORY_SECONDS;
+    JournalConfig journal = { NULL, 0, 0 };
+    int rt_prio = 0, rt_cpu = -1, bg_nice = 0;
+    bool lock_memory = false;
+    BaselineConfig baseline = Baseline_default();
+    DecimatorConfig decimator = Decimator_default();
+    FlickerMethod flicker = FLICKER_GOERTZEL;
+    int channels[SAMPLER_MAX_CHANNELS];
+    int legacy_width = -1, legacy_gap = -1;     // deprecated, in samples
+    int num_channels = 0;
 
     DipConfig dip = {
         .trigger_delta = 0.10,
         .release_delta = 0.07,
-        .min_width     = 2,
-        .min_gap       = 1
+        .min_width_ms  = 2.0,
+        .min_gap_ms    = 1.0
     };
 
     for (int i = 4; i < argc; i++) 
@@ -156,10 +245,60 @@ int main(int argc, char **argv)
         else if (!strncmp(argv[i], "--step=", 7))          step_hz = atoi(argv[i] + 7);
         else if (!strncmp(argv[i], "--dip-trig=", 11))     dip.trigger_delta = atof(argv[i] + 11);
         else if (!strncmp(argv[i], "--dip-rel=", 10))      dip.release_delta = atof(argv[i] + 10);
-        else if (!strncmp(argv[i], "--dip-width=", 12))    dip.min_width = atoi(argv[i] + 12);
-        else if (!strncmp(argv[i], "--dip-gap=", 10))      dip.min_gap = atoi(argv[i] + 10);
+        else if (!strncmp(argv[i], "--dip-width-ms=", 15)) dip.min_width_ms = atof(argv[i] + 15);
+        else if (!strncmp(argv[i], "--dip-gap-ms=", 13))   dip.min_gap_ms = atof(argv[i] + 13);
+        else if (!strncmp(argv[i], "--dip-width=", 12))
+        {
+            fprintf(stderr, "WARN: --dip-width=<samples> is deprecated; use --dip-width-ms=<ms>\n");
+            legacy_width = atoi(argv[i] + 12);
+        }
+        else if (!strncmp(argv[i], "--dip-gap=", 10))
+        {
+            fprintf(stderr, "WARN: --dip-gap=<samples> is deprecated; use --dip-gap-ms=<ms>\n");
+            legacy_gap = atoi(argv[i] + 10);
+        }
+        else if (!strncmp(argv[i], "--rate=", 7))          rate_hz = atoi(argv[i] + 7);
+        else if (!strncmp(argv[i], "--channels=", 11))
+        {
+            num_channels = parse_channels(argv[i] + 11, channels, SAMPLER_MAX_CHANNELS);
+            if (num_channels < 1)
+            {
+                fprintf(stderr, "WARN: bad channel list ignored: %s\n", argv[i]);
+                num_channels = 0;
+            }
+        }
+        else if (Baseline_parseArg(argv[i], &baseline))   continue;
+        else if (Decimator_parseArg(argv[i], &decimator)) continue;
+        else if (!strncmp(argv[i], "--flicker=", 10))
+        {
+            if (!Flicker_parseMethod(argv[i] + 10, &flicker))
+            {
+                fprintf(stderr, "WARN: unknown flicker method ignored: %s\n", argv[i]);
+            }
+        }
+        else if (!strncmp(argv[i], "--history=", 10))      history_s = atoi(argv[i] + 10);
+        else if (!strncmp(argv[i], "--journal=", 10))      journal.dir = argv[i] + 10;
+        else if (!strncmp(argv[i], "--journal-seg-mb=", 17))
+        {
+            int mb = atoi(argv[i] + 17);
+            if (mb <= 0)
+            {
+                fprintf(stderr, "WARN: bad segment size ignored: %s\n", argv[i]);
+                mb = 0;
+            }
+            journal.segment_bytes = (size_t)mb * 1024 * 1024;
+        }
+        else if (!strncmp(argv[i], "--journal-keep=", 15)) journal.max_segments = atoi(argv[i] + 15);
+        else if (!strncmp(argv[i], "--rt-prio=", 10))      rt_prio = atoi(argv[i] + 10);
+        else if (!strncmp(argv[i], "--rt-cpu=", 9))        rt_cpu = atoi(argv[i] + 9);
+        else if (!strncmp(argv[i], "--bg-nice=", 10))      bg_nice = atoi(argv[i] + 10);
+        else if (!strcmp(argv[i], "--mlock"))              lock_memory = true;
         else fprintf(stderr, "WARN: unknown arg ignored: %s\n", argv[i]);
     }
+    // The old flags counted samples at the sampling rate.
+    double ms_per_sample = 1000.0 / (rate_hz > 0 ? rate_hz : SAMPLER_DEFAULT_RATE_HZ);
+    if (legacy_width >= 0) dip.min_width_ms = legacy_width * ms_per_sample;
+    if (legacy_gap >= 0)   dip.min_gap_ms = legacy_gap * ms_per_sample;
 
     signal(SIGINT, on_sigint);
     signal(SIGTERM, on_sigint);
@@ -167,6 +306,19 @@ int main(int argc, char **argv)
     /* Timing module */
     Period_init();
 
+    // Scheduling: the sampler gets the CPU first; UDP and printing yield.
+    if (lock_memory)
+    {
+        Rt_lockMemory();
+    }
+    RtThreadConfig sampler_rt = Rt_default();
+    sampler_rt.fifo_priority        = clampi(rt_prio, 0, 99);
+    sampler_rt.cpu                  = rt_cpu;
+    sampler_rt.stack_bytes          = 256 * 1024;
+    sampler_rt.prefault_stack_bytes = 64 * 1024;
+    RtThreadConfig background_rt = Rt_default();
+    background_rt.nice = clampi(bg_nice, -20, 19);
+
     // LED init
     if (!Led_init(LED_PWM_DIR)) 
     {
@@ -208,14 +360,41 @@ int main(int argc, char **argv)
     {
         fprintf(stderr, "LightSensor_Init failed for %s ch%d (vref=%.3f)\n", spidev, adc_ch, vref);
     }
-    Sampler_init();
+    Sampler_setDipConfig(&dip);
+    Sampler_setBaselineConfig(&baseline);
+    Sampler_setDecimatorConfig(&decimator);
+    Sampler_setThreadConfig(&sampler_rt);
+    Sampler_setHistorySeconds(history_s);
+    if (num_channels > 0 && !Sampler_setChannels(channels, num_channels))
+    {
+        fprintf(stderr, "WARN: invalid --channels (0..7, no repeats); sampling ch%d only\n", adc_ch);
+    }
+    if (!Sampler_initWithRate(rate_hz))
+    {
+        fprintf(stderr, "Sampler_initWithRate(%d) failed\n", rate_hz);
+        LightSensor_Close();
+        Enc_shutdown();
+        Led_off(); Led_shutdown();
+        Period_cleanup();
+        return 5;
+    }
+    if (!Flicker_init(flicker, Sampler_getSampleRate()))
+    {
+        fprintf(stderr, "Flicker_init(%s) failed; continuing without it\n", Flicker_methodName(flicker));
+    }
     sleep_ms(600);
     Sampler_moveCurrentDataToHistory();
+    if (journal.dir && !Journal_start(&journal))
+    {
+        fprintf(stderr, "Journal_start(%s) failed; continuing without a journal\n", journal.dir);
+    }
 
-
+    udp_set_thread_config(&background_rt);
     if (!udp_start(12345, &udp_exit))
     {
         fprintf(stderr, "udp_start failed on port 12345\n");
+        Journal_stop();
+        Flicker_cleanup();
         Sampler_cleanup();
         LightSensor_Close();
         Enc_shutdown();
@@ -224,6 +403,14 @@ int main(int argc, char **argv)
         return 4;
     }
 
+    Rt_applyToSelf("main", &background_rt);
+
+    char baseline_desc[96];
+    Baseline_describe(&baseline, baseline_desc, sizeof(baseline_desc));
+    printf("Baseline: %s\n", baseline_desc);
+    char decimator_desc[96];
+    Decimator_describe(&decimator, Sampler_getSampleRate(), decimator_desc, sizeof(decimator_desc));
+    printf("Decimation: %s\n", decimator_desc);
     puts("Rotate encoder to change LED frequency. Ctrl+C to stop.");
 
     while (!g_stop && !atomic_load(&udp_exit))
@@ -263,20 +450,43 @@ int main(int argc, char **argv)
         Sampler_moveCurrentDataToHistory();
         Period_markEvent(PERIOD_EVENT_MARK_SECOND);
 
-        int n = 0;
-        double *hist = Sampler_getHistory(&n);
+        Sampler_snapshot_t hist;
+        Sampler_acquireHistory(&hist);
         double avg   = Sampler_getAverageReading();
 
-        int dips = Dip_count(hist, n, avg, &dip);
+        int dips = hist.dips;
+
+        Period_statistics_t ps = {0};
+        Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_LIGHT, &ps);
+        Sampler_timing_t timing;
+        Sampler_getTiming(&timing);
+
+        Flicker_result_t fr;
+        bool have_flicker = Flicker_analyze(&hist, cur_hz, &fr);
 
-        print_line1(n, cur_hz, avg, dips);
-        print_line2_samples(hist, n);
+        print_line1(hist.size, cur_hz, avg, dips, &ps, &timing);
+        print_line2_samples(hist.samples, hist.offsets_us, hist.size);
+        if (have_flicker) print_line_flicker(&fr);
+        print_line_channels(&hist);
         fflush(stdout);
 
-        free(hist);
+        udp_second_summary_t summary = {
+            .second  = hist.second,
+            .samples = hist.size,
+            .average = avg,
+            .dips    = dips,
+            .timing  = ps,
+            .ticks   = timing,
+            .flicker = fr,
+        };
+        udp_publish_second(&summary, &hist);
+
+        Sampler_releaseHistory(&hist);
     }
     
     udp_stop();
+    Journal_stop();
+    Flicker_cleanup();
     Sampler_cleanup();
     LightSensor_Close();
     Enc_shutdown();
@@ -327,7 +537,7 @@ sudo ./build/light_sampler \
   /dev/spidev0.1 0 3.300 \
   --chip=gpiochip2 --a=7 --b=8 --edges=4 \
   --start-hz=10 --duty=50 --step=1 \
-  --dip-trig=0.10 --dip-rel=0.07 --dip-width=2 --dip-gap=1
+  --dip-trig=0.10 --dip-rel=0.07 --dip-width-ms=2 --dip-gap-ms=1
 
 
 netcat -u 192.168.7.2 12345
@@ -0,0 +1,22 @@
+#include "names.h"
+
+#include <string.h>
+
+const char *Names_lookup(const char *const *names, int count, int value)
+{
+    if (value < 0 || value >= count) return "?";
+    return names[value];
+}
+
+bool Names_parse(const char *const *names, int count, const char *name, int *value)
+{
+    for (int i = 0; name && i < count; i++)
+    {
+        if (!strcmp(name, names[i]))
+        {
+            if (value) *value = i;
+            return true;
+        }
+    }
+    return false;
+}
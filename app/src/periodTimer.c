@@ -1,33 +1,63 @@
 #include <assert.h>
-#include <pthread.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 
 #include "periodTimer.h"
 
 // Written by Brian Fraser
 
+// Each mark records the period since the previous mark into one of two
+// histograms per event. Markers update the active one with atomics;
+// Period_getStatisticsAndClear() flips the active index, waits for
+// markers still inside the old histogram to leave, and then computes on
+// it without blocking anyone.
+
+// Log-linear buckets: periods below SUB_COUNT ns get one bucket per ns;
+// above that, each power of two is split into SUB_COUNT equal buckets.
+#define SUB_BITS    PERIOD_HIST_SUB_BITS
+#define SUB_COUNT   (1 << SUB_BITS)
+#define NUM_BUCKETS (SUB_COUNT * (PERIOD_HIST_MAX_BITS - SUB_BITS + 1))
+#define MAX_PERIOD_NS ((1LL << PERIOD_HIST_MAX_BITS) - 1)
 
 
 // Data collected
 typedef struct {
-    // Store the timestamp samples each time we mark an event.
-    long timestampCount;
-    long long timestampsInNs[MAX_EVENT_TIMESTAMPS];
+    _Atomic uint32_t counts[NUM_BUCKETS];
+    _Atomic long overflowed;
+    _Atomic long long sumNs;
+    _Atomic double sumSquaresNs2;
+    _Atomic long long minNs;
+    _Atomic long long maxNs;
+    // Markers currently updating this histogram.
+    _Atomic int writers;
+} histogram_t;
+
+typedef struct {
+    histogram_t histograms[2];
+    _Atomic int active;
 
-    // Used for recording the event between analysis periods.
-    long long prevTimestampInNs;
-} timestamps_t;
-static timestamps_t s_eventData[NUM_PERIOD_EVENTS];
+    // Time of the most recent mark (0 before the first one).
+    _Atomic long long prevTimestampInNs;
+} periodData_t;
+static periodData_t s_eventData[NUM_PERIOD_EVENTS];
 
-static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+// Serializes readers only; markers never take it.
+static atomic_flag s_readerLock = ATOMIC_FLAG_INIT;
 static bool s_initialized = false;
 
 
 // Prototypes
+static void clearHistogram(histogram_t *pHist);
+static void recordPeriod(histogram_t *pHist, long long periodNs);
 static void updateStats(
-    timestamps_t *pData, 
+    histogram_t *pHist,
     Period_statistics_t *pStats
 );
 static long long getTimeInNanoS(void);
@@ -36,6 +66,10 @@ static long long getTimeInNanoS(void);
 void Period_init(void)
 {
     memset(s_eventData, 0, sizeof(s_eventData[0]) * NUM_PERIOD_EVENTS);
+    for (int i = 0; i < NUM_PERIOD_EVENTS; i++) {
+        clearHistogram(&s_eventData[i].histograms[0]);
+        clearHistogram(&s_eventData[i].histograms[1]);
+    }
     s_initialized = true;
 }
 void Period_cleanup(void)
@@ -49,17 +83,29 @@ void Period_markEvent(enum Period_whichEvent whichEvent)
     assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
     assert (s_initialized);
 
-    timestamps_t *pData = &s_eventData[whichEvent];
-    pthread_mutex_lock(&s_lock);
-    {
-        if (pData->timestampCount < MAX_EVENT_TIMESTAMPS) {
-            pData->timestampsInNs[pData->timestampCount] = getTimeInNanoS();
-            pData->timestampCount++;
-        } else {
-            printf("WARNING: No sample space for event collection on %d\n", whichEvent);
+    periodData_t *pData = &s_eventData[whichEvent];
+    long long nowNs = getTimeInNanoS();
+    long long prevNs = atomic_exchange(&pData->prevTimestampInNs, nowNs);
+    if (prevNs == 0) {
+        return;     // first mark: no period yet
+    }
+
+    // Enter the active histogram; if a reader flipped it meanwhile, retry.
+    histogram_t *pHist;
+    for (;;) {
+        int idx = atomic_load(&pData->active);
+        pHist = &pData->histograms[idx];
+        atomic_fetch_add(&pHist->writers, 1);
+        if (atomic_load(&pData->active) == idx) {
+            break;
         }
+        atomic_fetch_sub(&pHist->writers, 1);
     }
-    pthread_mutex_unlock(&s_lock);
+
+    // Concurrent markers may swap in slightly out of order.
+    recordPeriod(pHist, nowNs > prevNs ? nowNs - prevNs : 0);
+
+    atomic_fetch_sub_explicit(&pHist->writers, 1, memory_order_release);
 }
 
 void Period_getStatisticsAndClear(
@@ -69,65 +115,139 @@ void Period_getStatisticsAndClear(
 {
     assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
     assert (s_initialized);
-    timestamps_t *pData = &s_eventData[whichEvent];
-    pthread_mutex_lock(&s_lock);
-    {
-        // Compute stats
-        updateStats(pData, pStats);
-
-        // Update the "previous" sample (if we have any)
-        if (pData->timestampCount > 0) {
-            pData->prevTimestampInNs = pData->timestampsInNs[pData->timestampCount - 1];
-        }
+    periodData_t *pData = &s_eventData[whichEvent];
+
+    while (atomic_flag_test_and_set_explicit(&s_readerLock, memory_order_acquire)) {
+        sched_yield();
+    }
+
+    // Swap histograms, then wait out markers that entered the old one.
+    // Store active / load writers here pairs with increment writers / load
+    // active in Period_markEvent(): all seq_cst, so at least one side sees
+    // the other and no marker records into the histogram being cleared.
+    int oldIdx = atomic_load(&pData->active);
+    atomic_store(&pData->active, oldIdx ^ 1);
+    histogram_t *pHist = &pData->histograms[oldIdx];
+    while (atomic_load(&pHist->writers) != 0) {
+        sched_yield();
+    }
+
+    // Compute stats
+    updateStats(pHist, pStats);
+
+    // Clear, ready for the next swap
+    clearHistogram(pHist);
+
+    atomic_flag_clear_explicit(&s_readerLock, memory_order_release);
+}
+
+static void clearHistogram(histogram_t *pHist)
+{
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        atomic_store_explicit(&pHist->counts[i], 0, memory_order_relaxed);
+    }
+    atomic_store(&pHist->overflowed, 0);
+    atomic_store(&pHist->sumNs, 0);
+    atomic_store(&pHist->sumSquaresNs2, 0.0);
+    atomic_store(&pHist->minNs, LLONG_MAX);
+    atomic_store(&pHist->maxNs, 0);
+}
+
+static int bucketOf(long long periodNs)
+{
+    if (periodNs < SUB_COUNT) {
+        return (int)periodNs;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long)periodNs);
+    int shift = msb - SUB_BITS;
+    return SUB_COUNT * (shift + 1) + (int)(periodNs >> shift) - SUB_COUNT;
+}
+
+// Lowest period that falls into `bucket`, and the bucket's width.
+static long long bucketLowNs(int bucket, long long *pWidthNs)
+{
+    if (bucket < SUB_COUNT) {
+        *pWidthNs = 1;
+        return bucket;
+    }
+    int shift = bucket / SUB_COUNT - 1;
+    *pWidthNs = 1LL << shift;
+    return (long long)(bucket % SUB_COUNT + SUB_COUNT) << shift;
+}
+
+static void recordPeriod(histogram_t *pHist, long long periodNs)
+{
+    if (periodNs > MAX_PERIOD_NS) {
+        atomic_fetch_add_explicit(&pHist->overflowed, 1, memory_order_relaxed);
+        periodNs = MAX_PERIOD_NS;
+    }
 
-        // Clear
-        pData->timestampCount = 0;
+    atomic_fetch_add_explicit(&pHist->counts[bucketOf(periodNs)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pHist->sumNs, periodNs, memory_order_relaxed);
+    double sq = (double)periodNs * (double)periodNs;
+    double oldSum = atomic_load_explicit(&pHist->sumSquaresNs2, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak(&pHist->sumSquaresNs2, &oldSum, oldSum + sq)) {
+    }
+
+    long long cur = atomic_load_explicit(&pHist->minNs, memory_order_relaxed);
+    while (periodNs < cur &&
+           !atomic_compare_exchange_weak(&pHist->minNs, &cur, periodNs)) {
+    }
+    cur = atomic_load_explicit(&pHist->maxNs, memory_order_relaxed);
+    while (periodNs > cur &&
+           !atomic_compare_exchange_weak(&pHist->maxNs, &cur, periodNs)) {
     }
-    pthread_mutex_unlock(&s_lock);
 }
 
 static void updateStats(
-    timestamps_t *pData, 
+    histogram_t *pHist,
     Period_statistics_t *pStats
 )
 {
-    long long prevInNs = pData->prevTimestampInNs;
-
-    // Handle startup (no previous sample)
-    if (prevInNs == 0) {
-        prevInNs = pData->timestampsInNs[0];
+    long count = 0;
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+        count += atomic_load_explicit(&pHist->counts[b], memory_order_relaxed);
     }
-    
-    // Find min/max/sum time delta between consecutive samples
-    long long sumDeltasNs = 0;
-    long long minNs = 0;
-    long long maxNs = 0;
-    for (int i = 0; i < pData->timestampCount; i++) {
-        long long thisTime = pData->timestampsInNs[i];
-        long long deltaNs = thisTime - prevInNs;
-        sumDeltasNs += deltaNs;
-
-        if (i == 0 || deltaNs < minNs) {
-            minNs = deltaNs;
-        }
-        if (i == 0 || deltaNs > maxNs) {
-            maxNs = deltaNs;
-        }
+    long long minNs = count > 0 ? atomic_load(&pHist->minNs) : 0;
+    long long maxNs = atomic_load(&pHist->maxNs);
 
-        prevInNs = thisTime;
+    double avgNs = 0;
+    double stdDevNs = 0;
+    if (count > 0) {
+        avgNs = (double)atomic_load(&pHist->sumNs) / count;
+        double variance = atomic_load(&pHist->sumSquaresNs2) / count - avgNs * avgNs;
+        stdDevNs = variance > 0 ? sqrt(variance) : 0;
     }
 
-    long long avgNs = 0;
-    if (pData->timestampCount > 0) {
-        avgNs = sumDeltasNs / pData->timestampCount;
-    } 
+    // Percentiles: walk the buckets once, reporting each bucket's
+    // midpoint clamped to the exact min/max.
+    static const double quantiles[] = { 0.50, 0.90, 0.99, 0.999 };
+    double percentileNs[4] = { 0 };
+    long seen = 0;
+    int q = 0;
+    for (int b = 0; b < NUM_BUCKETS && q < 4 && count > 0; b++) {
+        seen += atomic_load_explicit(&pHist->counts[b], memory_order_relaxed);
+        while (q < 4 && seen >= (long)ceil(quantiles[q] * count)) {
+            long long widthNs;
+            double midNs = bucketLowNs(b, &widthNs) + (widthNs - 1) / 2.0;
+            if (midNs < minNs) midNs = minNs;
+            if (midNs > maxNs) midNs = maxNs;
+            percentileNs[q++] = midNs;
+        }
+    }
 
     // Save stats
     #define MS_PER_NS (1000*1000.0)
     pStats->minPeriodInMs = minNs / MS_PER_NS;
     pStats->maxPeriodInMs = maxNs / MS_PER_NS;
     pStats->avgPeriodInMs = avgNs / MS_PER_NS;
-    pStats->numSamples = pData->timestampCount;
+    pStats->stdDevPeriodInMs = stdDevNs / MS_PER_NS;
+    pStats->p50PeriodInMs  = percentileNs[0] / MS_PER_NS;
+    pStats->p90PeriodInMs  = percentileNs[1] / MS_PER_NS;
+    pStats->p99PeriodInMs  = percentileNs[2] / MS_PER_NS;
+    pStats->p999PeriodInMs = percentileNs[3] / MS_PER_NS;
+    pStats->numSamples = (int)count;
+    pStats->numOverflowed = (int)atomic_load(&pHist->overflowed);
 }
 
 
@@ -135,17 +255,13 @@ static void updateStats(
 
 
 // Timing function
-static long long getTimeInNanoS(void) 
+static long long getTimeInNanoS(void)
 {
     struct timespec spec;
     clock_gettime(CLOCK_BOOTTIME, &spec);
     long long seconds = spec.tv_sec;
     long long nanoSeconds = spec.tv_nsec + seconds * 1000*1000*1000;
 	assert(nanoSeconds > 0);
-    
-    static long long lastTimeHack = 0;
-    assert(nanoSeconds > lastTimeHack);
-    lastTimeHack = nanoSeconds;
 
     return nanoSeconds;
 }
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE             // pthread_setaffinity_np(), pthread_setname_np()
+#include "rt_thread.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PAGE_GUESS 4096
+
+bool Rt_lockMemory(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        fprintf(stderr, "WARN: mlockall failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void Rt_initAttr(pthread_attr_t *attr, const RtThreadConfig *cfg)
+{
+    if (!attr || !cfg) return;
+
+    if (cfg->stack_bytes > 0)
+    {
+        size_t bytes = cfg->stack_bytes;
+        if (bytes < (size_t)PTHREAD_STACK_MIN) bytes = (size_t)PTHREAD_STACK_MIN;
+        if (pthread_attr_setstacksize(attr, bytes) != 0)
+        {
+            fprintf(stderr, "WARN: stack size %zu rejected\n", bytes);
+        }
+    }
+}
+
+// Touch `bytes` of stack below the caller, one write per page, so the
+// pages are mapped (and, after mlockall, locked) before the hot loop.
+__attribute__((noinline))
+static void prefault_stack(size_t bytes)
+{
+    char buf[bytes];
+    volatile char *p = buf;
+    for (size_t i = 0; i < bytes; i += PAGE_GUESS)
+    {
+        p[i] = 0;
+    }
+}
+
+bool Rt_applyToSelf(const char *name, const RtThreadConfig *cfg)
+{
+    if (!cfg) return true;
+    if (!name) name = "thread";
+
+    bool ok = true;
+    pthread_t self = pthread_self();
+
+    (void)pthread_setname_np(self, name);   // best effort (15 chars max)
+
+    if (cfg->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cfg->cpu, &set);
+        int err = pthread_setaffinity_np(self, sizeof(set), &set);
+        if (err != 0)
+        {
+            fprintf(stderr, "WARN: %s: pin to CPU %d failed: %s\n", name, cfg->cpu, strerror(err));
+            ok = false;
+        }
+    }
+
+    if (cfg->fifo_priority > 0)
+    {
+        struct sched_param sp = { .sched_priority = cfg->fifo_priority };
+        int err = pthread_setschedparam(self, SCHED_FIFO, &sp);
+        if (err != 0)
+        {
+            fprintf(stderr, "WARN: %s: SCHED_FIFO priority %d failed: %s\n",
+                    name, cfg->fifo_priority, strerror(err));
+            ok = false;
+        }
+    }
+    else if (cfg->nice != 0)
+    {
+        // Linux applies niceness per thread, addressed by its tid.
+        pid_t tid = (pid_t)syscall(SYS_gettid);
+        if (setpriority(PRIO_PROCESS, (id_t)tid, cfg->nice) != 0)
+        {
+            fprintf(stderr, "WARN: %s: nice %d failed: %s\n", name, cfg->nice, strerror(errno));
+            ok = false;
+        }
+    }
+
+    size_t prefault = cfg->prefault_stack_bytes;
+    if (cfg->stack_bytes > 0 && prefault > cfg->stack_bytes / 2)
+    {
+        prefault = cfg->stack_bytes / 2;     // leave room for the real frames
+    }
+    if (prefault > 0)
+    {
+        prefault_stack(prefault);
+    }
+
+    return ok;
+}
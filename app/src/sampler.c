@@ -4,12 +4,16 @@
 #include "hal/pwm_led.h"
 #include "hal/encoder.h"
 #include "periodTimer.h"
+#include "dip_detector.h"
+#include "baseline.h"
+#include "decimator.h"
 
 
 
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -17,29 +21,153 @@
 #include <unistd.h>
 #include <sys/timerfd.h>
 #include <time.h>
+#include <sched.h>
 
-#define MAX_SAMPLES 2000
+// Per-second frame capacity: twice the nominal rate leaves room for a
+// slow main loop without dropping samples.
+#define MAX_SAMPLES(rate_hz) (2 * (rate_hz))
+
+// The timer ticks at (about) 1 kHz; higher rates read several conversions
+// per tick in a single batched SPI transfer.
+#define TICK_HZ 1000
+
+// Share of a tick the batched transfer may take (the rest is left for the
+// filters, the dip detectors and wakeup latency), and the number of
+// transfers timed at init to measure what a scan costs.
+#define SPI_BUDGET_PERCENT 50
+#define SPI_PROBE_READS    4
+
+// Sample store: a pool of per-second frames. The sampling thread fills the
+// `current` frame; each second the frame pointer is moved into the history
+// ring (slot second % history_seconds), displacing the oldest second.
+// Readers share published frames (read-only) through a reference count.
+// Holders: the sampler owns one ref on `current`, the ring owns one ref on
+// each published frame, and each reader snapshot owns one more.
+// Pool: current + the ring + spares for frames pinned by slow readers
+// after the ring moved past them.
+#define FRAME_POOL_SPARES 3
+
+// Samples are kept structure-of-arrays: each channel's values stay
+// contiguous for the scanning code (channel k at samples + k * max_samples),
+// with one parallel array of µs offsets from `start_ns` shared by all
+// channels of a scan.
+struct sampler_frame {
+    _Atomic int refs;
+    _Atomic int count;      // scans stored (samples per channel)
+    _Atomic int dips[SAMPLER_MAX_CHANNELS];  // dips completed while current
+    long long second;       // index of the second, set when published
+    long long start_ns;     // CLOCK_MONOTONIC deadline of the first sample
+                            // (claim time until one is stored)
+    uint32_t *offsets_us;   // max_samples entries, after `samples`
+    sample_t samples[];     // num_channels * max_samples entries
+};
+
+_Static_assert(SAMPLER_MAX_CHANNELS == LIGHT_SENSOR_MAX_CHANNELS,
+               "one sampler channel per ADC input");
+
+// Bytes of samples[] rounded up so offsets_us[] that follows is aligned.
+#define FRAME_SAMPLES_BYTES(n) \
+    (((size_t)(n) * sizeof(sample_t) + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1))
+
+// Bytes of one frame with room for `scans` scans of `channels` channels.
+#define FRAME_BYTES(channels, scans) \
+    (sizeof(sampler_frame_t) + FRAME_SAMPLES_BYTES((size_t)(channels) * (scans)) \
+     + (size_t)(scans) * sizeof(uint32_t))
 
 static pthread_t sample_thread;
 
 static bool sample_running = false;
-static bool sample_average =  false;
 
 static int  sample_file_descriptor =  -1;
 
+static int sample_rate_hz = SAMPLER_DEFAULT_RATE_HZ;
+static int batch_size     = 1;      // conversions per timer tick
+static int max_samples    = MAX_SAMPLES(SAMPLER_DEFAULT_RATE_HZ);
+
+static int history_seconds = SAMPLER_DEFAULT_HISTORY_SECONDS;
+static int requested_history_seconds = SAMPLER_DEFAULT_HISTORY_SECONDS;
+static int pool_size = 0;
+static sampler_frame_t **frame_pool = NULL;
+
+// Dip detector fed per sample by the sampling thread (which owns it).
+static DipConfig dip_config;
+static bool      dip_config_set = false;
+static RtThreadConfig thread_config = { 0, 0, -1, 0, 0 };
+static DipStream dip_stream[SAMPLER_MAX_CHANNELS];
+
+// Baseline each channel's dips are measured against (sampling thread).
+static BaselineConfig baseline_config;
+static bool           baseline_config_set = false;
+static Baseline       baseline[SAMPLER_MAX_CHANNELS];
+static _Atomic long long baseline_frozen[SAMPLER_MAX_CHANNELS];
 
-static pthread_mutex_t lock =  PTHREAD_MUTEX_INITIALIZER;
+// Filter between each channel's raw samples and its baseline and dip
+// detector (sampling thread); the frames keep the raw samples.
+static DecimatorConfig decimator_config;
+static bool            decimator_config_set = false;
+static Decimator       decimator[SAMPLER_MAX_CHANNELS];
+static double          dip_rate_hz = SAMPLER_DEFAULT_RATE_HZ;
 
-static double current_samples[MAX_SAMPLES];
-static double history_samples[MAX_SAMPLES];
+// ADC channels scanned each tick; index 0 is the primary channel.
+static int  channel_ids[SAMPLER_MAX_CHANNELS];
+static int  num_channels = 1;
+static bool channels_set = false;
 
-static int c_number_samples = 0;
-static int h_number_samples = 0;
-static long long total_samples = 0;
+static sampler_frame_t *_Atomic current_frame = NULL;
+static sampler_frame_t *_Atomic *history_ring = NULL;    // history_seconds slots
+static _Atomic long long latest_second = -1;    // newest second in the ring
+// Frame the sampler is writing into right now (hazard pointer), so the
+// swap knows when the old current frame has become immutable.
+static sampler_frame_t *_Atomic writer_frame  = NULL;
 
-static double average = 0.0;
+// Counters and levels for other threads, published once per tick under a
+// sequence lock: the sampling thread never waits on a reader, and a reader
+// that overlapped an update simply copies again. The fields are relaxed
+// atomics so the copy is race-free; the fences order them against `seq`.
+typedef struct {
+    _Atomic unsigned  seq;              // odd while an update is in progress
+    _Atomic long long total;            // samples (scans) stored
+    _Atomic long long dropped;          // frame full or read failed
+    _Atomic long long read_errors;
+    _Atomic int       second_count;     // samples in the second being filled
+    _Atomic bool      primed[SAMPLER_MAX_CHANNELS];
+    _Atomic int32_t   average_q16[SAMPLER_MAX_CHANNELS];
+    _Atomic sample_t  second_min[SAMPLER_MAX_CHANNELS];
+    _Atomic sample_t  second_max[SAMPLER_MAX_CHANNELS];
+} stats_block_t;
 
-static int timer (void){
+static stats_block_t stats_block;
+
+// Sampling thread's side of the block.
+static long long stats_total   = 0;
+static long long stats_dropped = 0;
+static long long stats_errors  = 0;
+static sample_t  stats_min[SAMPLER_MAX_CHANNELS];
+static sample_t  stats_max[SAMPLER_MAX_CHANNELS];
+
+// Tick timing (written by the sampling thread; see Sampler_timing_t).
+static long long tick_period_ns = 1000000;
+static long long tick_start_ns  = 0;    // deadline of tick 0
+static long long tick_index     = 0;    // expirations seen so far
+static _Atomic long long ticks_serviced = 0;
+static _Atomic long long ticks_late     = 0;
+static _Atomic long long ticks_dropped  = 0;
+static _Atomic long long latency_sum_ns = 0;
+static _Atomic long long latency_max_ns = 0;
+static _Atomic int       latency_count  = 0;
+static long long next_second = 0;       // only touched by the mover
+static double volts_per_code = 3.3 / 4096.0;   // set from the sensor at init
+
+static long long monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Periodic timer on absolute deadlines: tick k expires at
+// tick_start_ns + k * period_ns, however late earlier ticks were read.
+static int timer (long long period_ns){
 
     int result =0 ;
     int descriptor =  timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
@@ -50,13 +178,17 @@ static int timer (void){
 
     else
     {
+        tick_period_ns = period_ns;
+        tick_start_ns  = monotonic_ns() + period_ns;
+        tick_index     = 0;
+
         struct itimerspec ts;
-        ts.it_value.tv_sec = 0;
-        ts.it_interval.tv_sec = 0;
-        ts.it_value.tv_nsec = 1000000;
-        ts.it_interval.tv_nsec= 1000000;
+        ts.it_value.tv_sec = tick_start_ns / 1000000000LL;
+        ts.it_interval.tv_sec = period_ns / 1000000000LL;
+        ts.it_value.tv_nsec = tick_start_ns % 1000000000LL;
+        ts.it_interval.tv_nsec= period_ns % 1000000000LL;
 
-        if(timerfd_settime(descriptor, 0, &ts, NULL) < 0)
+        if(timerfd_settime(descriptor, TFD_TIMER_ABSTIME, &ts, NULL) < 0)
         {
             close(descriptor);
             result = -1;
@@ -68,48 +200,371 @@ static int timer (void){
 
 }
 
-static void average_update(double value){
-    
-    if(!sample_average)
+// Account for `expirations` ticks read at once: the newest is serviced
+// now, the older ones are dropped. Returns the serviced tick's deadline.
+static long long tick_account(uint64_t expirations)
+{
+    tick_index += (long long)expirations;
+    long long deadline_ns = tick_start_ns + (tick_index - 1) * tick_period_ns;
+    long long now_ns      = monotonic_ns();
+    long long latency_ns  = now_ns - deadline_ns;
+    if (latency_ns < 0) latency_ns = 0;
+
+    atomic_fetch_add_explicit(&ticks_serviced, 1, memory_order_relaxed);
+    if (expirations > 1)
     {
-        average =  value;
-        sample_average = true;
+        atomic_fetch_add_explicit(&ticks_dropped, (long long)expirations - 1, memory_order_relaxed);
     }
-    else
+    if (latency_ns > tick_period_ns / 2)
+    {
+        atomic_fetch_add_explicit(&ticks_late, 1, memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&latency_sum_ns, latency_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&latency_count, 1, memory_order_relaxed);
+    long long max = atomic_load_explicit(&latency_max_ns, memory_order_relaxed);
+    while (latency_ns > max &&
+           !atomic_compare_exchange_weak(&latency_max_ns, &max, latency_ns))
+    {
+    }
+    return deadline_ns;
+}
+
+// Fold one filtered sample into its channel's baseline (after the dip
+// detector has judged it, so freezing can leave out samples inside a dip).
+static void average_update(int ch, uint16_t code)
+{
+    // Only the sampling thread touches the baseline; readers get the
+    // value through the stats block.
+    if (!Baseline_push(&baseline[ch], code, Dip_streamInDip(&dip_stream[ch])))
+    {
+        atomic_store_explicit(&baseline_frozen[ch],
+            atomic_load_explicit(&baseline_frozen[ch], memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    }
+}
+
+// Judge one filtered sample against its channel's average before it is
+// folded in.
+static int dip_push(int ch, uint16_t code)
+{
+    if (!baseline[ch].primed)
+    {
+        return 0;
+    }
+    int32_t ave_q16 = Baseline_valueQ16(&baseline[ch]);
+#ifdef SAMPLER_FIXED_POINT
+    return Dip_streamPushCode(&dip_stream[ch], code, ave_q16);
+#else
+    return Dip_streamPush(&dip_stream[ch], code * volts_per_code,
+                          (double)ave_q16 / DIP_Q16_ONE * volts_per_code);
+#endif
+}
+
+// Publish the sampling thread's counters and levels (once per tick).
+static void stats_publish(int second_count)
+{
+    stats_block_t *b = &stats_block;
+    unsigned seq = atomic_load_explicit(&b->seq, memory_order_relaxed);
+    atomic_store_explicit(&b->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&b->total, stats_total, memory_order_relaxed);
+    atomic_store_explicit(&b->dropped, stats_dropped, memory_order_relaxed);
+    atomic_store_explicit(&b->read_errors, stats_errors, memory_order_relaxed);
+    atomic_store_explicit(&b->second_count, second_count, memory_order_relaxed);
+    for (int ch = 0; ch < num_channels; ch++)
     {
-        average =  0.999*average + (0.001*value);
+        atomic_store_explicit(&b->primed[ch], baseline[ch].primed, memory_order_relaxed);
+        atomic_store_explicit(&b->average_q16[ch], Baseline_valueQ16(&baseline[ch]), memory_order_relaxed);
+        atomic_store_explicit(&b->second_min[ch], stats_min[ch], memory_order_relaxed);
+        atomic_store_explicit(&b->second_max[ch], stats_max[ch], memory_order_relaxed);
+    }
 
+    atomic_store_explicit(&b->seq, seq + 2, memory_order_release);
+}
 
+// Zero the counters and the published block (sampling thread stopped).
+static void stats_reset(void)
+{
+    stats_block_t *b = &stats_block;
+    stats_total   = 0;
+    stats_dropped = 0;
+    stats_errors  = 0;
+    atomic_store(&b->total, 0);
+    atomic_store(&b->dropped, 0);
+    atomic_store(&b->read_errors, 0);
+    atomic_store(&b->second_count, 0);
+    for (int ch = 0; ch < SAMPLER_MAX_CHANNELS; ch++)
+    {
+        stats_min[ch] = 0;
+        stats_max[ch] = 0;
+        atomic_store(&b->primed[ch], false);
+        atomic_store(&b->average_q16[ch], 0);
+        atomic_store(&b->second_min[ch], 0);
+        atomic_store(&b->second_max[ch], 0);
     }
+}
+
+// Copy the published block, retrying while the sampling thread is in the
+// middle of an update.
+static void stats_read(Sampler_stats_t *out)
+{
+    const stats_block_t *b = &stats_block;
+    int n = num_channels;
+    unsigned before, after;
+    do
+    {
+        before = atomic_load_explicit(&b->seq, memory_order_acquire);
+        out->total_samples   = atomic_load_explicit(&b->total, memory_order_relaxed);
+        out->dropped_samples = atomic_load_explicit(&b->dropped, memory_order_relaxed);
+        out->read_errors     = atomic_load_explicit(&b->read_errors, memory_order_relaxed);
+        out->second_samples  = atomic_load_explicit(&b->second_count, memory_order_relaxed);
+        for (int ch = 0; ch < n; ch++)
+        {
+            bool primed = atomic_load_explicit(&b->primed[ch], memory_order_relaxed);
+            int32_t q16 = atomic_load_explicit(&b->average_q16[ch], memory_order_relaxed);
+            sample_t lo = atomic_load_explicit(&b->second_min[ch], memory_order_relaxed);
+            sample_t hi = atomic_load_explicit(&b->second_max[ch], memory_order_relaxed);
+            out->average[ch]    = primed ? (double)q16 / DIP_Q16_ONE * volts_per_code : 0.0;
+            out->second_min[ch] = Sampler_toVolts(lo);
+            out->second_max[ch] = Sampler_toVolts(hi);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&b->seq, memory_order_relaxed);
+    } while (before != after || (before & 1u));
 
+    out->num_channels = n;
+    for (int ch = n; ch < SAMPLER_MAX_CHANNELS; ch++)
+    {
+        out->average[ch]    = 0.0;
+        out->second_min[ch] = 0.0;
+        out->second_max[ch] = 0.0;
+    }
+}
 
+// Read `scans` scans of every channel, interleaved [scan][channel].
+static int read_scans(sample_t *v, int scans)
+{
+#ifdef SAMPLER_FIXED_POINT
+    return LightSensor_ReadRawScans(v, scans);
+#else
+    return LightSensor_ReadVoltsScans(v, scans);
+#endif
+}
 
+// Nanoseconds one scan of every channel takes over SPI: the fastest of a
+// few `scans`-scan reads, so a probe that got preempted does not count.
+// 0 if the sensor could not be read.
+static long long measure_scan_ns(int scans)
+{
+    sample_t v[LIGHT_SENSOR_MAX_BATCH * SAMPLER_MAX_CHANNELS];
+    long long best = 0;
+    for (int k = 0; k < SPI_PROBE_READS; k++)
+    {
+        long long t0 = monotonic_ns();
+        if (read_scans(v, scans) != 0) continue;
+        long long t = monotonic_ns() - t0;
+        if (best == 0 || t < best) best = t;
+    }
+    return best / scans;
 }
 
-static bool sample_locked(void)
+static sampler_frame_t *frame_claim(void)
 {
-    if (c_number_samples >= MAX_SAMPLES) 
+    for (int i = 0; i < pool_size; i++)
     {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&frame_pool[i]->refs, &expected, 1))
+        {
+            atomic_store_explicit(&frame_pool[i]->count, 0, memory_order_relaxed);
+            for (int ch = 0; ch < SAMPLER_MAX_CHANNELS; ch++)
+            {
+                atomic_store_explicit(&frame_pool[i]->dips[ch], 0, memory_order_relaxed);
+            }
+            frame_pool[i]->start_ns = monotonic_ns();
+            return frame_pool[i];
+        }
+    }
+    return NULL;
+}
+
+static void frame_release(sampler_frame_t *f)
+{
+    if (f)
+    {
+        atomic_fetch_sub(&f->refs, 1);
+    }
+}
+
+static void frames_free(void)
+{
+    for (int i = 0; frame_pool && i < pool_size; i++)
+    {
+        free(frame_pool[i]);
+    }
+    free(frame_pool);
+    frame_pool = NULL;
+    pool_size = 0;
+    free((void *)history_ring);
+    history_ring = NULL;
+}
+
+static void channel_filters_free(void)
+{
+    for (int ch = 0; ch < SAMPLER_MAX_CHANNELS; ch++)
+    {
+        Baseline_free(&baseline[ch]);
+        Decimator_free(&decimator[ch]);
+    }
+}
+
+// Seconds the ring can keep within SAMPLER_MAX_HISTORY_BYTES at the
+// current rate and channel count (at least 1).
+static int history_fit(int seconds)
+{
+    size_t frame_bytes = FRAME_BYTES(num_channels, max_samples);
+    size_t frames = SAMPLER_MAX_HISTORY_BYTES / frame_bytes;
+    int fit = frames > (size_t)(1 + FRAME_POOL_SPARES) ? (int)(frames - 1 - FRAME_POOL_SPARES) : 1;
+    return seconds < fit ? seconds : fit;
+}
+
+static bool frames_alloc(void)
+{
+    pool_size    = history_seconds + 1 + FRAME_POOL_SPARES;
+    frame_pool   = calloc((size_t)pool_size, sizeof(*frame_pool));
+    history_ring = calloc((size_t)history_seconds, sizeof(*history_ring));
+    if (!frame_pool || !history_ring)
+    {
+        frames_free();
         return false;
     }
+    for (int i = 0; i < history_seconds; i++)
+    {
+        atomic_init(&history_ring[i], NULL);
+    }
+    atomic_store(&latest_second, -1);
+
+    for (int i = 0; i < pool_size; i++)
+    {
+        size_t samples_bytes = FRAME_SAMPLES_BYTES((size_t)num_channels * max_samples);
+        frame_pool[i] = malloc(FRAME_BYTES(num_channels, max_samples));
+        if (!frame_pool[i])
+        {
+            frames_free();
+            return false;
+        }
+        frame_pool[i]->offsets_us = (uint32_t *)((char *)frame_pool[i]->samples + samples_bytes);
+        atomic_init(&frame_pool[i]->refs, 0);
+        atomic_init(&frame_pool[i]->count, 0);
+        for (int ch = 0; ch < SAMPLER_MAX_CHANNELS; ch++)
+        {
+            atomic_init(&frame_pool[i]->dips[ch], 0);
+        }
+    }
+    return true;
+}
 
-    double v = 0.0;
-    if (LightSensor_ReadVolts(&v) != 0)
+// Read one tick's worth of scans of every channel (one SPI transaction) and
+// append them to the current frame. Each scan is stamped with the time it
+// was due: the tick's deadline plus its share of the tick period, so the
+// stamps do not pick up wakeup or transfer jitter.
+static bool sample_batch(long long deadline_ns)
+{
+    sample_t v[LIGHT_SENSOR_MAX_BATCH * SAMPLER_MAX_CHANNELS];
+    if (read_scans(v, batch_size) != 0)
     {
+        stats_errors++;
+        stats_dropped += batch_size;
+        sampler_frame_t *f = atomic_load(&current_frame);
+        stats_publish(f ? atomic_load_explicit(&f->count, memory_order_relaxed) : 0);
         return false;
     }
 
-    current_samples[c_number_samples++] = v;
-    total_samples++;
-    average_update(v);
+    // Announce which frame we write into, then confirm it is still current.
+    sampler_frame_t *f;
+    do
+    {
+        f = atomic_load(&current_frame);
+        atomic_store(&writer_frame, f);
+    } while (atomic_load(&current_frame) != f);
+
+    int take = 0;
+    if (f)
+    {
+        int c = atomic_load_explicit(&f->count, memory_order_relaxed);
+        take = max_samples - c;
+        if (take > batch_size) take = batch_size;
+        if (take > 0)
+        {
+            // Each channel's raw samples go into the frame; its decimated
+            // stream feeds its own average and detector, and dips land in
+            // the frame where they complete. Min/max restart with each frame.
+            for (int ch = 0; ch < num_channels; ch++)
+            {
+                sample_t *dst = &f->samples[(size_t)ch * max_samples + c];
+                sample_t lo = c > 0 ? stats_min[ch] : v[ch];
+                sample_t hi = c > 0 ? stats_max[ch] : v[ch];
+                for (int i = 0; i < take; i++)
+                {
+                    sample_t value = v[i * num_channels + ch];
+                    dst[i] = value;
+                    if (value < lo) lo = value;
+                    if (value > hi) hi = value;
+                }
+                stats_min[ch] = lo;
+                stats_max[ch] = hi;
+
+#ifdef SAMPLER_FIXED_POINT
+                const uint16_t *codes = dst;
+#else
+                uint16_t codes[LIGHT_SENSOR_MAX_BATCH];
+                for (int i = 0; i < take; i++) codes[i] = Sampler_toCode(dst[i]);
+#endif
+                uint16_t filtered[LIGHT_SENSOR_MAX_BATCH];
+                int m = Decimator_process(&decimator[ch], codes, take, filtered);
+                int dips = 0;
+                for (int j = 0; j < m; j++)
+                {
+                    dips += dip_push(ch, filtered[j]);
+                    average_update(ch, filtered[j]);
+                }
+                if (dips > 0)
+                {
+                    atomic_store_explicit(&f->dips[ch],
+                        atomic_load_explicit(&f->dips[ch], memory_order_relaxed) + dips,
+                        memory_order_relaxed);
+                }
+            }
+            if (c == 0) f->start_ns = deadline_ns;
+            for (int i = 0; i < take; i++)
+            {
+                long long t_ns = deadline_ns + tick_period_ns * i / batch_size;
+                long long off_us = (t_ns - f->start_ns) / 1000;
+                f->offsets_us[c + i] = off_us > 0 ? (uint32_t)off_us : 0;
+            }
+            atomic_store_explicit(&f->count, c + take, memory_order_release);
+        }
+    }
+    atomic_store(&writer_frame, NULL);
+
+    stats_total   += take;
+    stats_dropped += batch_size - take;
+    stats_publish(f ? atomic_load_explicit(&f->count, memory_order_relaxed) : 0);
+    if (take == 0)
+    {
+        return false;
+    }
+    // One mark per tick: with batching, the tick is the periodic event.
     Period_markEvent(PERIOD_EVENT_SAMPLE_LIGHT);
-    return true;
+    return take == batch_size;
 }
 
 
 static void *sample_worker(void *arg)
 {
     (void)arg;
+    Rt_applyToSelf("sampler", &thread_config);
     while (true)
      {
         uint64_t ticks = 0;
@@ -124,45 +579,229 @@ static void *sample_worker(void *arg)
             continue;                       
         }
 
-        pthread_mutex_lock(&lock);
-        int space = MAX_SAMPLES - c_number_samples;
-        int take  = (int)ticks;
-        if (take > space) take = space;     
-
-        for (int i = 0; i < take; i++) 
-        {
-            if (!sample_locked()) 
-            {
-                break;
-            }
-        }
-        pthread_mutex_unlock(&lock);
+        // One batch for the newest deadline; missed ones are not caught
+        // up back-to-back (that would bunch the samples).
+        long long deadline_ns = tick_account(ticks);
+        (void)sample_batch(deadline_ns);
     }
     return NULL;
 }
 
-void Sampler_init(void)
+bool Sampler_init(void)
+{
+    return Sampler_initWithRate(SAMPLER_DEFAULT_RATE_HZ);
+}
+
+bool Sampler_initWithRate(int rate_hz)
 {
 
     if(sample_running)
     {
-        return;
+        return true;
+    }
+
+    int requested_hz = rate_hz;
+    if (rate_hz < SAMPLER_MIN_RATE_HZ) rate_hz = SAMPLER_MIN_RATE_HZ;
+    if (rate_hz > SAMPLER_MAX_RATE_HZ) rate_hz = SAMPLER_MAX_RATE_HZ;
+    if (rate_hz != requested_hz)
+    {
+        fprintf(stderr, "WARN: sample rate %d Hz out of range; using %d Hz\n", requested_hz, rate_hz);
+    }
+
+    // Scan the requested channels if the sensor accepts them; otherwise
+    // stay on the channel it was initialised with.
+    if (channels_set)
+    {
+        LightSensor_SetChannels(channel_ids, num_channels);
+    }
+    num_channels = LightSensor_GetChannels(channel_ids, SAMPLER_MAX_CHANNELS);
+    if (num_channels < 1 || num_channels > SAMPLER_MAX_CHANNELS)
+    {
+        num_channels   = 1;
+        channel_ids[0] = 0;
+    }
+
+    // Every channel is converted at the full rate, so a tick's transfer
+    // grows with both. Lower the rate until a tick's scans fit the budget.
+    batch_size = (rate_hz + TICK_HZ - 1) / TICK_HZ;
+    long long scan_ns   = measure_scan_ns(batch_size);
+    long long budget_ns = 1000000000LL / TICK_HZ * SPI_BUDGET_PERCENT / 100;
+    if (scan_ns > 0 && scan_ns * batch_size > budget_ns)
+    {
+        int fit = (int)(budget_ns / scan_ns);
+        if (fit < 1) fit = 1;
+        fprintf(stderr, "WARN: a scan of %d channels takes %lld us over SPI; %d Hz needs %lld us "
+                "per %d us tick, using %d Hz\n", num_channels, scan_ns / 1000, rate_hz,
+                scan_ns * batch_size / 1000, 1000000 / TICK_HZ, fit * TICK_HZ);
+        rate_hz    = fit * TICK_HZ;
+        batch_size = fit;
+    }
+
+    sample_rate_hz = rate_hz;
+    max_samples    = MAX_SAMPLES(rate_hz);
+
+    history_seconds = history_fit(requested_history_seconds);
+    if (history_seconds < requested_history_seconds)
+    {
+        fprintf(stderr, "WARN: %d s of history at %d Hz x %d channels exceeds %u MiB; keeping %d s\n",
+                requested_history_seconds, rate_hz, num_channels,
+                SAMPLER_MAX_HISTORY_BYTES >> 20, history_seconds);
+    }
+    if (!frames_alloc())
+    {
+        fprintf(stderr, "Sampler: out of memory for %d history frames\n",
+                history_seconds + 1 + FRAME_POOL_SPARES);
+        return false;
+    }
+    volts_per_code = LightSensor_VoltsPerCode();
+    for (int ch = 0; ch < num_channels; ch++)
+    {
+        // Dip widths and the baseline's time scales apply at the
+        // decimated rate.
+        if (!Decimator_init(&decimator[ch], decimator_config_set ? &decimator_config : NULL, rate_hz))
+        {
+            fprintf(stderr, "Sampler: out of memory for the ch%d decimator\n", channel_ids[ch]);
+            channel_filters_free();
+            frames_free();
+            return false;
+        }
+        dip_rate_hz = decimator[ch].out_rate_hz;
+        Dip_streamInit(&dip_stream[ch], dip_config_set ? &dip_config : NULL, dip_rate_hz);
+        Dip_streamSetCodeScale(&dip_stream[ch], volts_per_code);
+        atomic_store(&baseline_frozen[ch], 0);
+        if (!Baseline_init(&baseline[ch], baseline_config_set ? &baseline_config : NULL,
+                           rate_hz / Decimator_factor(&decimator[ch])))
+        {
+            fprintf(stderr, "Sampler: out of memory for the ch%d baseline\n", channel_ids[ch]);
+            channel_filters_free();
+            frames_free();
+            return false;
+        }
     }
 
-    sample_file_descriptor = timer();
+    stats_reset();
+    atomic_store(&ticks_serviced, 0);
+    atomic_store(&ticks_late, 0);
+    atomic_store(&ticks_dropped, 0);
+    atomic_store(&latency_sum_ns, 0);
+    atomic_store(&latency_max_ns, 0);
+    atomic_store(&latency_count, 0);
+    sample_file_descriptor = timer(1000000000LL * batch_size / rate_hz);
     if (sample_file_descriptor < 0)
     {
-        return;
+        fprintf(stderr, "Sampler: timerfd: %s\n", strerror(errno));
+        channel_filters_free();
+        frames_free();
+        return false;
     }
 
+    atomic_store(&current_frame, frame_claim());
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    Rt_initAttr(&attr, &thread_config);
+
     sample_running =  true;
-    if (pthread_create(&sample_thread, NULL, sample_worker, NULL) != 0)
+    int err = pthread_create(&sample_thread, &attr, sample_worker, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0)
     {
+        fprintf(stderr, "Sampler: pthread_create: %s\n", strerror(err));
         sample_running = false;
         close(sample_file_descriptor);
         sample_file_descriptor = -1;
+        atomic_store(&current_frame, NULL);
+        channel_filters_free();
+        frames_free();
+        return false;
+    }
+    return true;
+}
+void Sampler_setDipConfig(const DipConfig *cfg)
+{
+    if (!cfg || sample_running) return;
+
+    dip_config     = *cfg;
+    dip_config_set = true;
+}
+
+bool Sampler_setChannels(const int *channels, int n)
+{
+    if (!channels || n < 1 || n > SAMPLER_MAX_CHANNELS || sample_running) return false;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (channels[i] < 0 || channels[i] >= SAMPLER_MAX_CHANNELS) return false;
+        for (int j = 0; j < i; j++)
+        {
+            if (channels[j] == channels[i]) return false;
+        }
     }
+    memcpy(channel_ids, channels, (size_t)n * sizeof(int));
+    num_channels = n;
+    channels_set = true;
+    return true;
+}
+
+int Sampler_getNumChannels(void)
+{
+    return num_channels;
+}
+
+int Sampler_getChannelId(int index)
+{
+    if (index < 0 || index >= num_channels) return -1;
+    return channel_ids[index];
+}
+
+void Sampler_setBaselineConfig(const BaselineConfig *cfg)
+{
+    if (!cfg || sample_running) return;
+
+    baseline_config     = *cfg;
+    baseline_config_set = true;
+}
+
+void Sampler_getBaselineConfig(BaselineConfig *cfg)
+{
+    if (!cfg) return;
+
+    *cfg = baseline_config_set ? baseline_config : Baseline_default();
+}
+
+void Sampler_setDecimatorConfig(const DecimatorConfig *cfg)
+{
+    if (!cfg || sample_running) return;
+
+    decimator_config     = *cfg;
+    decimator_config_set = true;
+}
+
+void Sampler_getDecimatorConfig(DecimatorConfig *cfg)
+{
+    if (!cfg) return;
+
+    *cfg = decimator_config_set ? decimator_config : Decimator_default();
+}
+
+double Sampler_getDipRate(void)
+{
+    return dip_rate_hz;
+}
+
+long long Sampler_getBaselineFrozen(int index)
+{
+    if (index < 0 || index >= num_channels) return 0;
+    return atomic_load_explicit(&baseline_frozen[index], memory_order_relaxed);
+}
+
+void Sampler_setThreadConfig(const RtThreadConfig *cfg)
+{
+    if (!cfg || sample_running) return;
+
+    thread_config = *cfg;
 }
+
 void Sampler_cleanup(void)
 {
     if(!sample_running)
@@ -176,97 +815,354 @@ void Sampler_cleanup(void)
         sample_file_descriptor  =-1;
     }
     pthread_join(sample_thread, NULL);
-    pthread_mutex_lock(&lock);
-    c_number_samples = 0;
-    h_number_samples = 0;
-    total_samples    = 0;
-    average          = 0.0;
-    sample_average   = false;
-    pthread_mutex_unlock(&lock);
+
+    // Callers must have released their snapshots before cleanup.
+    atomic_store(&current_frame, NULL);
+    atomic_store(&latest_second, -1);
+    frames_free();
+    channel_filters_free();
+    stats_reset();
+    next_second = 0;
 }
 
 void Sampler_moveCurrentDataToHistory(void)
 {
-    pthread_mutex_lock(&lock);
-    if (c_number_samples > 0)
+    sampler_frame_t *fresh = frame_claim();
+    if (!fresh)
     {
-        memcpy(history_samples, current_samples, (size_t)c_number_samples * sizeof(double));
-        h_number_samples = c_number_samples;
-    } 
-    else 
+        // Every spare frame is pinned by a reader: keep filling the current
+        // frame (it drops samples once full) and try again next second.
+        return;
+    }
+
+    sampler_frame_t *old = atomic_exchange(&current_frame, fresh);
+
+    // Wait out a sample store that raced the swap (at most a few stores).
+    while (old && atomic_load(&writer_frame) == old)
     {
-        h_number_samples = 0;
+        sched_yield();
     }
-    c_number_samples = 0; 
-    pthread_mutex_unlock(&lock);
 
+    // The current frame's ref becomes the ring's ref; the frame it
+    // displaces (history_seconds ago) loses the ring's ref.
+    if (old)
+    {
+        old->second = next_second++;
+        int slot = (int)(old->second % history_seconds);
+        frame_release(atomic_exchange(&history_ring[slot], old));
+        atomic_store(&latest_second, old->second);
+    }
+}
 
+// Pin the frame of `second` if it is still in the ring.
+static sampler_frame_t *acquire_second(long long second)
+{
+    if (second < 0 || !history_ring) return NULL;
 
+    _Atomic(sampler_frame_t *) *slot = &history_ring[second % history_seconds];
+    while (true)
+    {
+        sampler_frame_t *f = atomic_load(slot);
+        if (!f)
+        {
+            return NULL;
+        }
+        atomic_fetch_add(&f->refs, 1);
+        if (atomic_load(slot) == f)
+        {
+            if (f->second == second)
+            {
+                return f;
+            }
+            frame_release(f);   // slot already holds a different second
+            return NULL;
+        }
+        // Swapped out before our ref landed: back off and retry.
+        frame_release(f);
+    }
 }
 
-int Sampler_getHistorySize(void)
+static void fill_snapshot(Sampler_snapshot_t *snap, sampler_frame_t *f)
+{
+    snap->frame   = f;
+    snap->samples = f ? f->samples : NULL;
+    snap->offsets_us = f ? f->offsets_us : NULL;
+    snap->start_ns   = f ? f->start_ns : 0;
+    snap->size    = f ? atomic_load_explicit(&f->count, memory_order_acquire) : 0;
+    snap->second  = f ? f->second : -1;
+    snap->rate_hz = sample_rate_hz;
+    snap->num_channels   = f ? num_channels : 0;
+    snap->channel_stride = max_samples;
+    for (int ch = 0; ch < SAMPLER_MAX_CHANNELS; ch++)
+    {
+        snap->channel_dips[ch] = f && ch < num_channels
+            ? atomic_load_explicit(&f->dips[ch], memory_order_relaxed) : 0;
+    }
+    snap->dips    = snap->channel_dips[0];
+}
+
+const sample_t *Sampler_snapshotChannel(const Sampler_snapshot_t *snap, int index)
+{
+    if (!snap || !snap->samples || index < 0 || index >= snap->num_channels) return NULL;
+    return snap->samples + (size_t)index * snap->channel_stride;
+}
+
+void Sampler_acquireHistory(Sampler_snapshot_t *snap)
 {
+    if (!snap) return;
 
-    pthread_mutex_lock(&lock);
-    int n =  h_number_samples;
-    pthread_mutex_unlock(&lock);
+    // Retry if the ring moved on between reading the index and pinning.
+    sampler_frame_t *f = NULL;
+    long long second;
+    do
+    {
+        second = atomic_load(&latest_second);
+        f = acquire_second(second);
+    } while (!f && second >= 0 && second != atomic_load(&latest_second));
+
+    fill_snapshot(snap, f);
+}
+
+bool Sampler_acquireSecond(long long second, Sampler_snapshot_t *snap)
+{
+    if (!snap) return false;
+
+    sampler_frame_t *f = acquire_second(second);
+    fill_snapshot(snap, f);
+    return f != NULL;
+}
+
+int Sampler_acquireRange(long long first_second, int count, Sampler_snapshot_t *snaps)
+{
+    if (!snaps || count <= 0) return 0;
+
+    int n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (Sampler_acquireSecond(first_second + i, &snaps[n]))
+        {
+            n++;
+        }
+    }
     return n;
 }
 
+int Sampler_acquireLast(int k, Sampler_snapshot_t *snaps)
+{
+    long long latest = atomic_load(&latest_second);
+    if (latest < 0 || k <= 0) return 0;
+    if (k > history_seconds) k = history_seconds;
+
+    long long first = latest - k + 1;
+    if (first < 0) first = 0;
+    return Sampler_acquireRange(first, (int)(latest - first + 1), snaps);
+}
+
+void Sampler_releaseRange(Sampler_snapshot_t *snaps, int n)
+{
+    for (int i = 0; snaps && i < n; i++)
+    {
+        Sampler_releaseHistory(&snaps[i]);
+    }
+}
+
+void Sampler_getHistoryRange(long long *oldest, long long *latest)
+{
+    long long newest = atomic_load(&latest_second);
+    long long first  = newest - history_seconds + 1;
+    if (first < 0) first = 0;
+    if (newest < 0) first = -1;
+
+    if (oldest) *oldest = first;
+    if (latest) *latest = newest;
+}
+
+int Sampler_getHistorySeconds(void)
+{
+    return history_seconds;
+}
+
+void Sampler_setHistorySeconds(int seconds)
+{
+    if (sample_running) return;
+
+    if (seconds < 1) seconds = 1;
+    if (seconds > SAMPLER_MAX_HISTORY_SECONDS) seconds = SAMPLER_MAX_HISTORY_SECONDS;
+    requested_history_seconds = seconds;
+    history_seconds = seconds;
+}
+
+void Sampler_releaseHistory(Sampler_snapshot_t *snap)
+{
+    if (!snap) return;
+
+    frame_release(snap->frame);
+    snap->frame   = NULL;
+    snap->samples = NULL;
+    snap->offsets_us = NULL;
+    snap->start_ns   = 0;
+    snap->size    = 0;
+    snap->dips    = 0;
+    snap->second  = -1;
+    snap->num_channels = 0;
+    memset(snap->channel_dips, 0, sizeof(snap->channel_dips));
+}
+
+int Sampler_getHistorySize(void)
+{
+    Sampler_snapshot_t snap;
+    Sampler_acquireHistory(&snap);
+    int n = snap.size;
+    Sampler_releaseHistory(&snap);
+    return n;
+}
+
+int Sampler_getHistoryDips(void)
+{
+    Sampler_snapshot_t snap;
+    Sampler_acquireHistory(&snap);
+    int d = snap.dips;
+    Sampler_releaseHistory(&snap);
+    return d;
+}
+
 double* Sampler_getHistory(int *size)
 {
     if (!size) return NULL;
 
-    pthread_mutex_lock(&lock);
-    int n = h_number_samples;
+    Sampler_snapshot_t snap;
+    Sampler_acquireHistory(&snap);
+    int n = snap.size;
     double *out = NULL;
     if (n > 0) 
     {
         out = (double*)malloc((size_t)n * sizeof(double));
         if (out)
         {
-            memcpy(out, history_samples, (size_t)n * sizeof(double));
+            for (int i = 0; i < n; i++)
+            {
+                out[i] = Sampler_toVolts(snap.samples[i]);
+            }
         }
         else
         {
             n=0;
         }
     }
-    pthread_mutex_unlock(&lock);
+    Sampler_releaseHistory(&snap);
 
     *size = n;
     return out; 
 }
 
-double Sampler_getAverageReading(void)
+double* Sampler_getHistoryWithTimes(int *size, uint32_t **offsets_us)
 {
+    if (!size || !offsets_us) return NULL;
 
-    pthread_mutex_lock(&lock);
-    double a;
-    if(sample_average)
-    {
-        a =  average;
-    }
-    else
+    Sampler_snapshot_t snap;
+    Sampler_acquireHistory(&snap);
+    int n = snap.size;
+    double *out = NULL;
+    uint32_t *times = NULL;
+    if (n > 0)
     {
-        a =  0.0;
-    
+        out   = (double*)malloc((size_t)n * sizeof(double));
+        times = (uint32_t*)malloc((size_t)n * sizeof(uint32_t));
+        if (out && times)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                out[i] = Sampler_toVolts(snap.samples[i]);
+            }
+            memcpy(times, snap.offsets_us, (size_t)n * sizeof(uint32_t));
+        }
+        else
+        {
+            free(out);
+            free(times);
+            out = NULL;
+            times = NULL;
+            n = 0;
+        }
     }
-    pthread_mutex_unlock(&lock);
-    return a;
+    Sampler_releaseHistory(&snap);
+
+    *size = n;
+    *offsets_us = times;
+    return out;
 }
 
-long long Sampler_getNumSamplesTaken(void)
+double Sampler_getAverageReading(void)
+{
+    return Sampler_getChannelAverage(0);
+}
+
+double Sampler_getChannelAverage(int index)
 {
+    if (index < 0 || index >= num_channels) return 0.0;
 
+    Sampler_stats_t st;
+    stats_read(&st);
+    return st.average[index];
+}
+
+void Sampler_getStats(Sampler_stats_t *stats)
+{
+    if (!stats) return;
 
-    pthread_mutex_lock(&lock);
-    long long t = total_samples;
-    pthread_mutex_unlock(&lock);
-    return t;
+    stats_read(stats);
 }
 
+double Sampler_getVoltsPerCode(void)
+{
+    return volts_per_code;
+}
 
+uint16_t Sampler_toCode(sample_t sample)
+{
+#ifdef SAMPLER_FIXED_POINT
+    return sample;
+#else
+    double c = sample / volts_per_code + 0.5;
+    if (c < 0.0) return 0;
+    if (c > 4095.0) return 4095;
+    return (uint16_t)c;
+#endif
+}
 
+double Sampler_toVolts(sample_t sample)
+{
+#ifdef SAMPLER_FIXED_POINT
+    return (double)sample * volts_per_code;
+#else
+    return sample;
+#endif
+}
 
+int Sampler_getSampleRate(void)
+{
+    return sample_rate_hz;
+}
+
+long long Sampler_getNumSamplesTaken(void)
+{
+    return atomic_load_explicit(&stats_block.total, memory_order_relaxed);
+}
 
+void Sampler_getTiming(Sampler_timing_t *timing)
+{
+    if (!timing) return;
+
+    // The interval counters are reset one by one; a tick landing in
+    // between may be split across two intervals, which is fine here.
+    int count        = atomic_exchange(&latency_count, 0);
+    long long sum_ns = atomic_exchange(&latency_sum_ns, 0);
+    long long max_ns = atomic_exchange(&latency_max_ns, 0);
+
+    timing->ticks          = atomic_load_explicit(&ticks_serviced, memory_order_relaxed);
+    timing->late_ticks     = atomic_load_explicit(&ticks_late, memory_order_relaxed);
+    timing->dropped_ticks  = atomic_load_explicit(&ticks_dropped, memory_order_relaxed);
+    timing->latency_count  = count;
+    timing->avg_latency_us = count > 0 ? (double)sum_ns / count / 1000.0 : 0.0;
+    timing->max_latency_us = (double)max_ns / 1000.0;
+}
@@ -1,9 +1,11 @@
+#define _GNU_SOURCE             // sendmmsg(), recvmmsg()
 #define _POSIX_C_SOURCE 200809L
 
 #include "sampler.h"
 #include "dip_detector.h"
 #include "periodTimer.h"
 #include "udp.h"
+#include "udp_clients.h"
 #include "hal/light_sensor.h"
 #include "hal/pwm_led.h"
 #include "hal/encoder.h"
@@ -23,57 +25,69 @@
 #include <sys/socket.h>
 #include <netinet/in.h> 
 #include <stdatomic.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 
 static pthread_t  thr;
+static bool thr_started = false;
 static int  sock= -1;
+static int  epoll_fd = -1;
+static int  wake_fd  = -1;     // eventfd: written by udp_stop() to end the worker
 static  _Atomic bool *stop=  NULL;
 static _Atomic bool running =  false;
 
-static struct sockaddr_storage client; // client address
-static socklen_t  client_length=0; // client's address size
-static _Atomic bool have_client =  false;
-
-static char command[16] =  "";
-
 #ifndef MAXIMUM_SEND
 #define MAXIMUM_SEND 1500 
 #endif
 //maximum packet to send
 
+// Binary history datagrams stay within one Ethernet frame
+// (1500 MTU - 20 IP - 8 UDP) so they are never IP-fragmented.
+#define HISTORY_BIN_MAX_DATAGRAM 1472
+#define HISTORY_BIN_MAX_SAMPLES  ((HISTORY_BIN_MAX_DATAGRAM - UDP_HISTORY_BIN_HEADER_SIZE) / 2)
 
-static int last_dips= 0;
-
-
-//functoin to analyse the dips last second
-//helper functions
+// Seconds sent per `last`/`range` command (bounds one reply burst).
+#define UDP_RANGE_MAX_SECONDS 10
 
+static uint32_t history_bin_seq = 0;   // datagram sequence number (worker thread only)
+static uint32_t push_seq = 0;          // same, for the pushed stream (publisher only)
+static unsigned push_first = 0;        // subscriber served first, rotated per second
+static _Atomic long long push_dropped = 0;  // pushed datagrams sendmmsg() refused
 
+// Datagrams for one second's push (summary + binary history at the
+// highest sample rate), built once and sent to every subscriber.
+#define PUSH_MAX_DATAGRAMS (1 + (2 * SAMPLER_MAX_RATE_HZ) / HISTORY_BIN_MAX_SAMPLES + 1)
+// sendmmsg() vector length per call.
+#define PUSH_BATCH 64
 
-static void analyse_last_second_dips(void)
-{
+// Commands drained per recvmmsg() call, and replies queued per sendmmsg().
+#define UDP_RECV_BATCH 32
+#define UDP_SEND_BATCH 64
+#define UDP_MAX_COMMAND 1024
+// Longest piece of an unknown command quoted back in the error reply.
+#define UDP_ECHO_COMMAND 48
 
-    int n= 0;
-    double* h=Sampler_getHistory(&n);
-    if (!h || n <=0)
-    {
-        last_dips=0;
-        free(h);
-        return;
-    }
+// Replies from the worker are queued and sent in one sendmmsg() per burst.
+typedef struct {
+    struct mmsghdr msgs[UDP_SEND_BATCH];
+    struct iovec iov[UDP_SEND_BATCH];
+    struct sockaddr_storage addr[UDP_SEND_BATCH];
+    char data[UDP_SEND_BATCH][MAXIMUM_SEND];
+    int count;
+} reply_queue_t;
 
-    double average = Sampler_getAverageReading();
-    DipConfig config= Dip_default(); //initializinf  the dip detector
-    last_dips =  Dip_count(h,n, average, &config);
-    free(h);
-}
+static reply_queue_t replies;   // worker thread only
 
+static RtThreadConfig thread_config = { 0, 0, -1, 0, 0 };
 
-static int get_last_second_dips(void)
-{
-    return last_dips;
+// Tick timing and flicker from the latest published second, for the
+// `timing` and `flicker` commands.
+static Sampler_timing_t last_timing;
+static Flicker_result_t last_flicker;
+static pthread_mutex_t last_timing_lock = PTHREAD_MUTEX_INITIALIZER;
 
-}
 
 //repalcing th eh /r or /n from teh string and pad with 0;
 
@@ -101,24 +115,69 @@ static int is_blank(const char *s)
     return *s=='\0';
 }
 
-static int send_to_client(const void *buf, size_t len, const struct sockaddr *p, socklen_t pl)
+static void replies_flush(void)
 {
-    return sendto(sock, buf, len, 0, p, pl) == (ssize_t)len;
+    int sent = 0;
+    while (sent < replies.count)
+    {
+        int r = sendmmsg(sock, &replies.msgs[sent], (unsigned)(replies.count - sent), 0);
+        if (r < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+        sent += r;
+    }
+    replies.count = 0;
 }
 
-//API
+// Bytes of a reply that snprintf() formatted into a buffer of `size`:
+// its return value is the untruncated length, which must never be sent.
+static size_t reply_len(int n, size_t size)
+{
+    if (n < 0) return 0;
+    return (size_t)n < size ? (size_t)n : size - 1;
+}
 
-bool udp_send(const void *data, size_t len)
- {
-    if (!have_client) 
+// Append to a reply being built in out[0..size), with *n its length so
+// far. Once the buffer is full nothing more is appended, so *n never
+// passes size - 1 (the reply is cut short instead of overrun).
+static void reply_appendf(char *out, size_t size, size_t *n, const char *fmt, ...)
+{
+    if (*n + 1 >= size) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int m = vsnprintf(out + *n, size - *n, fmt, ap);
+    va_end(ap);
+    *n += reply_len(m, size - *n);
+}
+
+// Queue a reply datagram; it goes out with the rest of the burst.
+static int send_to_client(const void *buf, size_t len, const struct sockaddr *p, socklen_t pl)
+{
+    if (len > MAXIMUM_SEND || (size_t)pl > sizeof(struct sockaddr_storage))
     {
-        return false;
+        return 0;
+    }
+    if (replies.count == UDP_SEND_BATCH)
+    {
+        replies_flush();
     }
 
-    return send_to_client(data, len, (struct sockaddr*)&client, client_length);
+    int i = replies.count++;
+    memcpy(replies.data[i], buf, len);
+    memcpy(&replies.addr[i], p, (size_t)pl);
+    replies.iov[i].iov_base = replies.data[i];
+    replies.iov[i].iov_len  = len;
+    memset(&replies.msgs[i], 0, sizeof(replies.msgs[i]));
+    replies.msgs[i].msg_hdr.msg_name    = &replies.addr[i];
+    replies.msgs[i].msg_hdr.msg_namelen = pl;
+    replies.msgs[i].msg_hdr.msg_iov     = &replies.iov[i];
+    replies.msgs[i].msg_hdr.msg_iovlen  = 1;
+    return 1;
 }
 
-//END
 
 static void help(const struct sockaddr *p, socklen_t pl)
 {
@@ -128,7 +187,19 @@ static void help(const struct sockaddr *p, socklen_t pl)
         "length -- get the number of samples taken in the previously completed\n"
         "second.\n"
         "dips -- get the number of dips in the previously completed second.\n"
+        "timing -- get the sampler's late/dropped tick counts and latency.\n"
+        "channels -- get each sampled channel's average and dips last second.\n"
+        "baseline -- get the baseline and decimation settings and each channel's baseline.\n"
+        "stats -- get the sample and push-drop counters and this second's min/max so far.\n"
+        "flicker -- get last second's flicker frequency and the LED's.\n"
         "history -- get all the samples in the previously completed second.\n"
+        "history.bin -- same samples as packed 16-bit ADC codes (binary).\n"
+        "seconds -- get the range of seconds held in the history ring.\n"
+        "last <k> -- history.bin for each of the last k seconds.\n"
+        "range <first> <count> -- history.bin for seconds first..first+count-1.\n"
+        "subscribe -- get a summary line pushed every second.\n"
+        "subscribe history -- same, plus each second's history.bin datagrams.\n"
+        "unsubscribe -- stop the pushed updates.\n"
         "stop -- cause the server program to end.\n"
         "<enter> -- repeat last command.\n";
     send_to_client(m, strlen(m), p, pl);
@@ -138,30 +209,114 @@ static void count(const struct sockaddr *p, socklen_t pl)
 {
     char out[64];
     int n = snprintf(out, sizeof(out), "# samples taken total: %lld\n", Sampler_getNumSamplesTaken());
-    send_to_client(out, (size_t)n, p, pl);
+    send_to_client(out, reply_len(n, sizeof(out)), p, pl);
 }
 
 static void length(const struct sockaddr *p, socklen_t pl)
  {
     char out[64];
     int n = snprintf(out, sizeof(out), "# samples taken last second: %d\n", Sampler_getHistorySize());
-    send_to_client(out, (size_t)n, p, pl);
+    send_to_client(out, reply_len(n, sizeof(out)), p, pl);
+}
+
+static void timing(const struct sockaddr *p, socklen_t pl)
+{
+    pthread_mutex_lock(&last_timing_lock);
+    Sampler_timing_t t = last_timing;
+    pthread_mutex_unlock(&last_timing_lock);
+
+    char out[192];
+    int n = snprintf(out, sizeof(out),
+        "# ticks: %lld late: %lld dropped: %lld latency last second: avg %.1fus max %.1fus\n",
+        t.ticks, t.late_ticks, t.dropped_ticks, t.avg_latency_us, t.max_latency_us);
+    send_to_client(out, reply_len(n, sizeof(out)), p, pl);
 }
 
 static void dips(const struct sockaddr *p, socklen_t pl)
  {
-    analyse_last_second_dips();
-    int d = get_last_second_dips();
+    int d = Sampler_getHistoryDips();
     char out[64];
     
     int n = snprintf(out, sizeof(out), "# Dips: %d\n", d);
-    send_to_client(out, (size_t)n, p, pl);
+    send_to_client(out, reply_len(n, sizeof(out)), p, pl);
 }
 
-static void send_history(const struct sockaddr *addr, socklen_t addr_len)
+static void channels(const struct sockaddr *p, socklen_t pl)
+{
+    Sampler_snapshot_t snap;
+    Sampler_acquireHistory(&snap);
+    char out[64 * SAMPLER_MAX_CHANNELS];
+    size_t n = 0;
+    for (int k = 0; k < Sampler_getNumChannels(); k++)
+    {
+        reply_appendf(out, sizeof(out), &n, "# ch%d: avg %.3fV dips %d%s\n",
+                      Sampler_getChannelId(k), Sampler_getChannelAverage(k),
+                      k < snap.num_channels ? snap.channel_dips[k] : 0,
+                      k == 0 ? " (primary)" : "");
+    }
+    Sampler_releaseHistory(&snap);
+    send_to_client(out, n, p, pl);
+}
+
+static void stats(const struct sockaddr *p, socklen_t pl)
+{
+    Sampler_stats_t st;
+    Sampler_getStats(&st);
+    char out[128 + 80 * SAMPLER_MAX_CHANNELS];
+    size_t n = 0;
+    reply_appendf(out, sizeof(out), &n,
+        "# samples: %lld dropped: %lld read errors: %lld this second: %d\n",
+        st.total_samples, st.dropped_samples, st.read_errors, st.second_samples);
+    reply_appendf(out, sizeof(out), &n, "# push datagrams dropped: %lld\n",
+                  (long long)atomic_load(&push_dropped));
+    for (int k = 0; k < st.num_channels; k++)
+    {
+        reply_appendf(out, sizeof(out), &n,
+                      "# ch%d: avg %.3fV min %.3fV max %.3fV\n", Sampler_getChannelId(k),
+                      st.average[k], st.second_min[k], st.second_max[k]);
+    }
+    send_to_client(out, n, p, pl);
+}
+
+static void baseline(const struct sockaddr *p, socklen_t pl)
+{
+    BaselineConfig cfg;
+    Sampler_getBaselineConfig(&cfg);
+    DecimatorConfig decim;
+    Sampler_getDecimatorConfig(&decim);
+    char baseline_desc[96], decim_desc[96];
+    Baseline_describe(&cfg, baseline_desc, sizeof(baseline_desc));
+    Decimator_describe(&decim, Sampler_getSampleRate(), decim_desc, sizeof(decim_desc));
+
+    char out[224 + 64 * SAMPLER_MAX_CHANNELS];
+    size_t n = 0;
+    reply_appendf(out, sizeof(out), &n, "# baseline: %s\n# decimation: %s\n",
+                  baseline_desc, decim_desc);
+    for (int k = 0; k < Sampler_getNumChannels(); k++)
+    {
+        reply_appendf(out, sizeof(out), &n, "# ch%d: %.3fV frozen %lld samples\n",
+                      Sampler_getChannelId(k), Sampler_getChannelAverage(k),
+                      Sampler_getBaselineFrozen(k));
+    }
+    send_to_client(out, n, p, pl);
+}
+
+static void flicker(const struct sockaddr *p, socklen_t pl)
+{
+    pthread_mutex_lock(&last_timing_lock);
+    Flicker_result_t f = last_flicker;
+    pthread_mutex_unlock(&last_timing_lock);
+
+    char out[192];
+    int n = snprintf(out, sizeof(out),
+        "# flicker (%s): %.2f Hz %.3fV LED: %.0f Hz sampling: %.1f Hz%s\n",
+        Flicker_methodName(Flicker_getMethod()), f.freq_hz, f.amplitude_v,
+        f.expected_hz, f.rate_hz, f.aliased ? " (aliased)" : "");
+    send_to_client(out, reply_len(n, sizeof(out)), p, pl);
+}
+
+void udp_format_history(const sample_t *samples, int count, udp_emit_fn emit, void *ctx)
 {
-    int count = 0;
-    double *samples = Sampler_getHistory(&count);
     char out[MAXIMUM_SEND];
     size_t used = 0;
     int on_line = 0;
@@ -173,16 +328,16 @@ static void send_history(const struct sockaddr *addr, socklen_t addr_len)
         int tok_len;
         if (on_line == 0)
         {
-            tok_len = snprintf(tok, sizeof(tok), "%.3f", samples[i]);
+            tok_len = snprintf(tok, sizeof(tok), "%.3f", Sampler_toVolts(samples[i]));
         }
         else
         {
-            tok_len = snprintf(tok, sizeof(tok), ", %.3f", samples[i]);
+            tok_len = snprintf(tok, sizeof(tok), ", %.3f", Sampler_toVolts(samples[i]));
         }
 
         if (used + (size_t)tok_len > sizeof(out))
          {
-            send_to_client(out, used, addr, addr_len);
+            emit(out, used, ctx);
             used = 0;
         }
 
@@ -194,7 +349,7 @@ static void send_history(const struct sockaddr *addr, socklen_t addr_len)
          {
             if (used + 1 > sizeof(out)) 
             {
-                send_to_client(out, used, addr, addr_len);
+                emit(out, used, ctx);
                 used = 0;
             }
             out[used++] = '\n';
@@ -207,7 +362,7 @@ static void send_history(const struct sockaddr *addr, socklen_t addr_len)
      {
         if (used + 1 > sizeof(out)) 
         {
-            send_to_client(out, used, addr, addr_len);
+            emit(out, used, ctx);
             used = 0;
         }
         out[used++] = '\n';
@@ -215,124 +370,507 @@ static void send_history(const struct sockaddr *addr, socklen_t addr_len)
 
     if (used)
      {
-        send_to_client(out, used, addr, addr_len);
+        emit(out, used, ctx);
     }
+}
 
-    free(samples);
+static uint8_t *put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
 }
 
+static uint8_t *put_le32(uint8_t *p, uint32_t v)
+{
+    p = put_le16(p, (uint16_t)v);
+    return put_le16(p, (uint16_t)(v >> 16));
+}
 
+void udp_format_history_bin(const sample_t *samples, int count, uint32_t second,
+                            uint32_t *seq, double volts_per_code,
+                            udp_emit_fn emit, void *ctx)
+{
+    uint8_t out[HISTORY_BIN_MAX_DATAGRAM];
+    uint32_t scale_bits;
+    float scale = (float)volts_per_code;
+    memcpy(&scale_bits, &scale, sizeof(scale_bits));
+
+    // An empty second still gets one (header-only) datagram as an answer.
+    int offset = 0;
+    do
+    {
+        int chunk = count - offset;
+        if (chunk > HISTORY_BIN_MAX_SAMPLES) chunk = HISTORY_BIN_MAX_SAMPLES;
+
+        uint8_t *p = out;
+        p = put_le16(p, UDP_HISTORY_BIN_MAGIC);
+        *p++ = UDP_HISTORY_BIN_VERSION;
+        *p++ = 0;                               // flags (reserved)
+        p = put_le32(p, (*seq)++);
+        p = put_le32(p, second);
+        p = put_le16(p, (uint16_t)count);
+        p = put_le16(p, (uint16_t)offset);
+        p = put_le16(p, (uint16_t)chunk);
+        p = put_le32(p, scale_bits);
+
+        for (int i = 0; i < chunk; i++)
+        {
+            p = put_le16(p, Sampler_toCode(samples[offset + i]));
+        }
 
+        emit((const char *)out, (size_t)(p - out), ctx);
+        offset += chunk;
+    } while (offset < count);
+}
 
-static void *worker(void *unused)
+typedef struct {
+    const struct sockaddr *addr;
+    socklen_t addr_len;
+} reply_target_t;
+
+static void emit_to_client(const char *buf, size_t len, void *ctx)
 {
+    const reply_target_t *t = ctx;
+    send_to_client(buf, len, t->addr, t->addr_len);
+}
 
+static void send_history(const struct sockaddr *addr, socklen_t addr_len)
+{
+    Sampler_snapshot_t snap;
+    Sampler_acquireHistory(&snap);
 
-    (void)unused;
-    running= true;
+    reply_target_t target = { addr, addr_len };
+    udp_format_history(snap.samples, snap.size, emit_to_client, &target);
+
+    Sampler_releaseHistory(&snap);
+}
+
+
+
+
+static void send_seconds(const struct sockaddr *p, socklen_t pl)
+{
+    long long oldest, latest;
+    Sampler_getHistoryRange(&oldest, &latest);
+
+    char out[96];
+    int n = snprintf(out, sizeof(out), "# history seconds: %lld..%lld (ring of %d)\n",
+                     oldest, latest, Sampler_getHistorySeconds());
+    send_to_client(out, reply_len(n, sizeof(out)), p, pl);
+}
+
+// history.bin datagrams for each requested second still in the ring.
+static void send_range_bin(long long first, int count, bool last_k,
+                           const struct sockaddr *addr, socklen_t addr_len)
+{
+    if (count > UDP_RANGE_MAX_SECONDS) count = UDP_RANGE_MAX_SECONDS;
 
-    while(true)
+    Sampler_snapshot_t snaps[UDP_RANGE_MAX_SECONDS];
+    int n = last_k ? Sampler_acquireLast(count, snaps)
+                   : Sampler_acquireRange(first, count, snaps);
+    if (n == 0)
     {
-        if(stop && atomic_load(stop))
+        const char *msg = "(no such seconds in history)\n";
+        send_to_client(msg, strlen(msg), addr, addr_len);
+        return;
+    }
+
+    reply_target_t target = { addr, addr_len };
+    for (int i = 0; i < n; i++)
+    {
+        udp_format_history_bin(snaps[i].samples, snaps[i].size, (uint32_t)snaps[i].second,
+                               &history_bin_seq, Sampler_getVoltsPerCode(),
+                               emit_to_client, &target);
+    }
+    Sampler_releaseRange(snaps, n);
+}
+
+static void send_history_bin(const struct sockaddr *addr, socklen_t addr_len)
+{
+    Sampler_snapshot_t snap;
+    Sampler_acquireHistory(&snap);
+
+    reply_target_t target = { addr, addr_len };
+    udp_format_history_bin(snap.samples, snap.size, (uint32_t)(snap.second < 0 ? 0 : snap.second),
+                           &history_bin_seq, Sampler_getVoltsPerCode(),
+                           emit_to_client, &target);
+
+    Sampler_releaseHistory(&snap);
+}
+
+typedef struct {
+    char data[PUSH_MAX_DATAGRAMS][HISTORY_BIN_MAX_DATAGRAM];
+    size_t len[PUSH_MAX_DATAGRAMS];
+    int count;
+} push_datagrams_t;
+
+static push_datagrams_t push;    // publisher (main loop) only
+
+static void emit_to_push(const char *buf, size_t len, void *ctx)
+{
+    (void)ctx;
+    if (push.count < PUSH_MAX_DATAGRAMS && len <= sizeof(push.data[0]))
+    {
+        memcpy(push.data[push.count], buf, len);
+        push.len[push.count] = len;
+        push.count++;
+    }
+}
+
+// Send a push batch without blocking. A short count means message `sent`
+// was refused (full socket buffer, unreachable peer): count it as dropped
+// and carry on with the rest, like replies_flush().
+static void push_flush(struct mmsghdr *msgs, int count)
+{
+    int sent = 0;
+    while (sent < count)
+    {
+        int r = sendmmsg(sock, &msgs[sent], (unsigned)(count - sent), MSG_DONTWAIT);
+        if (r < 0)
         {
-            break;
+            if (errno == EINTR) continue;
+            atomic_fetch_add(&push_dropped, 1);
+            sent++;
+            continue;
         }
+        sent += r;
+    }
+}
 
-        char buf[1024];
-        struct sockaddr_storage from;
-        socklen_t from_len= sizeof(from);
+void udp_publish_second(const udp_second_summary_t *summary, const Sampler_snapshot_t *hist)
+{
+    if (!summary || sock < 0) return;
+
+    pthread_mutex_lock(&last_timing_lock);
+    last_timing  = summary->ticks;
+    last_flicker = summary->flicker;
+    pthread_mutex_unlock(&last_timing_lock);
+
+    // Take a private copy of the table so sending happens unlocked.
+    udp_subscriber_t subs[UDP_MAX_SUBSCRIBERS];
+    int num_subs = udp_clients_get_subscribers(subs, UDP_MAX_SUBSCRIBERS);
+    if (num_subs == 0) return;
+    bool any_history = false;
+    for (int i = 0; i < num_subs; i++)
+    {
+        any_history |= subs[i].want_history;
+    }
 
-        ssize_t n = recvfrom(sock, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &from_len);
-        if (n < 0)
+    // Datagram 0 is the summary; the rest are the binary history.
+    push.count = 0;
+    char line[512];
+    int n = snprintf(line, sizeof(line),
+        "second=%lld samples=%d avg=%.3f dips=%d "
+        "period_ms=[%.3f, %.3f] avg_ms=%.3f sd_ms=%.3f "
+        "p50_ms=%.3f p99_ms=%.3f p999_ms=%.3f events=%d "
+        "lat_avg_us=%.1f lat_max_us=%.1f late=%lld dropped=%lld "
+        "flicker_hz=%.2f flicker_v=%.3f led_hz=%.0f\n",
+        summary->second, summary->samples, summary->average, summary->dips,
+        summary->timing.minPeriodInMs, summary->timing.maxPeriodInMs,
+        summary->timing.avgPeriodInMs, summary->timing.stdDevPeriodInMs,
+        summary->timing.p50PeriodInMs, summary->timing.p99PeriodInMs,
+        summary->timing.p999PeriodInMs, summary->timing.numSamples,
+        summary->ticks.avg_latency_us, summary->ticks.max_latency_us,
+        summary->ticks.late_ticks, summary->ticks.dropped_ticks,
+        summary->flicker.freq_hz, summary->flicker.amplitude_v,
+        summary->flicker.expected_hz);
+    emit_to_push(line, reply_len(n, sizeof(line)), NULL);
+    if (any_history && hist)
+    {
+        udp_format_history_bin(hist->samples, hist->size,
+                               (uint32_t)(hist->second < 0 ? 0 : hist->second),
+                               &push_seq, Sampler_getVoltsPerCode(), emit_to_push, NULL);
+    }
+
+    // One mmsghdr per (subscriber, datagram), sent in sendmmsg() batches.
+    // The first subscriber rotates so a full socket buffer does not
+    // always cost the same ones at the end of the table.
+    struct mmsghdr msgs[PUSH_BATCH];
+    struct iovec iov[PUSH_BATCH];
+    int queued = 0;
+    int first = (int)(push_first++ % (unsigned)num_subs);
+    for (int k = 0; k < num_subs; k++)
+    {
+        int s_i = (first + k) % num_subs;
+        int datagrams = subs[s_i].want_history ? push.count : 1;
+        for (int d = 0; d < datagrams; d++)
         {
-            if (errno == EINTR)
-            {
-                continue;
-            }
-            if (!atomic_load(&running))
+            iov[queued].iov_base = push.data[d];
+            iov[queued].iov_len  = push.len[d];
+            memset(&msgs[queued], 0, sizeof(msgs[queued]));
+            msgs[queued].msg_hdr.msg_name    = &subs[s_i].addr;
+            msgs[queued].msg_hdr.msg_namelen = subs[s_i].addr_len;
+            msgs[queued].msg_hdr.msg_iov     = &iov[queued];
+            msgs[queued].msg_hdr.msg_iovlen  = 1;
+            if (++queued == PUSH_BATCH)
             {
-                break;
-
+                push_flush(msgs, queued);
+                queued = 0;
             }
-            
-            continue;
         }
+    }
+    if (queued > 0)
+    {
+        push_flush(msgs, queued);
+    }
+}
 
-        buf[n]= '\0';
-        trim(buf);
+// Handle one command datagram; returns true when the server must stop.
+static bool handle_command(char *buf, const struct sockaddr *from, socklen_t from_len, long long now_ns)
+{
+    if (!udp_clients_admit(from, from_len, now_ns))
+    {
+        return false;       // over its rate limit: drop silently
+    }
 
-        memcpy(&client, &from, from_len);
-        client_length= from_len;
-        atomic_store(&running, true);
+    trim(buf);
 
-        const char *cmd = buf;
-        char repeat[16];
+    const char *cmd = buf;
+    char repeat[UDP_CLIENT_COMMAND_LEN];
+    udp_clients_get_last_command(from, from_len, repeat, sizeof(repeat));
 
-        if (is_blank(buf))
+    if (is_blank(buf))
+    {
+        if (!repeat[0])
         {
-            if (!command[0])
-            {
-                const char *msg = "(no last command)\n";
-                send_to_client(msg, strlen(msg),(struct sockaddr *)&from, from_len);
-                continue;
-            }
-            snprintf(repeat, sizeof(repeat), "%s", command);
-            cmd = repeat;
+            const char *msg = "(no last command)\n";
+            send_to_client(msg, strlen(msg),from, from_len);
+            return false;
         }
+        cmd = repeat;
+    }
+
+
+
+    if (!strcmp(cmd, "help") || !strcmp(cmd, "?"))
+    {
+        help(from, from_len);
+        udp_clients_set_last_command(from, from_len, cmd);
+    }
+     else if (!strcmp(cmd, "count"))
+    {
+        count(from, from_len);
+        udp_clients_set_last_command(from, from_len, "count");
+    }
+
+     else if (!strcmp(cmd, "length"))
+    {
+        length(from, from_len);
+        udp_clients_set_last_command(from, from_len, "length");
+    }
+
+     else if (!strcmp(cmd, "timing"))
+    {
+        timing(from, from_len);
+        udp_clients_set_last_command(from, from_len, "timing");
+    }
+
+     else if (!strcmp(cmd, "dips"))
+    {
+        dips(from, from_len);
+        udp_clients_set_last_command(from, from_len, "dips");
+    }
+
+    else if (!strcmp(cmd, "channels"))
+    {
+        channels(from, from_len);
+        udp_clients_set_last_command(from, from_len, "channels");
+    }
+
+    else if (!strcmp(cmd, "stats"))
+    {
+        stats(from, from_len);
+        udp_clients_set_last_command(from, from_len, "stats");
+    }
+
+    else if (!strcmp(cmd, "flicker"))
+    {
+        flicker(from, from_len);
+        udp_clients_set_last_command(from, from_len, "flicker");
+    }
+
+    else if (!strcmp(cmd, "baseline"))
+    {
+        baseline(from, from_len);
+        udp_clients_set_last_command(from, from_len, "baseline");
+    }
+
+    else if (!strcmp(cmd, "history"))
+    {
+        send_history(from, from_len);
+        udp_clients_set_last_command(from, from_len, "history");
+    }
 
+    else if (!strcmp(cmd, "history.bin"))
+    {
+        send_history_bin(from, from_len);
+        udp_clients_set_last_command(from, from_len, "history.bin");
+    }
 
+    else if (!strcmp(cmd, "seconds"))
+    {
+        send_seconds(from, from_len);
+        udp_clients_set_last_command(from, from_len, "seconds");
+    }
 
-        if (!strcmp(cmd, "help") || !strcmp(cmd, "?"))
+    else if (!strncmp(cmd, "last ", 5) || !strncmp(cmd, "range ", 6))
+    {
+        long long first = 0;
+        int count = 0;
+        bool last_k = (cmd[0] == 'l');
+        bool ok = last_k ? sscanf(cmd + 5, "%d", &count) == 1
+                         : sscanf(cmd + 6, "%lld %d", &first, &count) == 2;
+        if (ok && count > 0)
         {
-            help((struct sockaddr *)&from, from_len);
-            snprintf(command, sizeof(command), "%s", cmd);
+            send_range_bin(first, count, last_k, from, from_len);
+            udp_clients_set_last_command(from, from_len, cmd);
         }
-         else if (!strcmp(cmd, "count"))
+        else
         {
-            count((struct sockaddr *)&from, from_len);
-            snprintf(command, sizeof(command), "count");
+            const char *msg = "Usage: last <k> | range <first> <count>\n";
+            send_to_client(msg, strlen(msg), from, from_len);
         }
+    }
+
+    else if (!strcmp(cmd, "subscribe") || !strcmp(cmd, "subscribe history"))
+    {
+        bool want_history = (strcmp(cmd, "subscribe") != 0);
+        const char *msg = udp_clients_subscribe(from, from_len, want_history, UDP_MAX_SUBSCRIBERS)
+                        ? "Subscribed.\n" : "Subscriber table full.\n";
+        send_to_client(msg, strlen(msg), from, from_len);
+        udp_clients_set_last_command(from, from_len, cmd);
+    }
+
+    else if (!strcmp(cmd, "unsubscribe"))
+    {
+        udp_clients_unsubscribe(from, from_len);
+        const char *msg = "Unsubscribed.\n";
+        send_to_client(msg, strlen(msg), from, from_len);
+        udp_clients_set_last_command(from, from_len, "unsubscribe");
+    }
+
+    else if (!strcmp(cmd, "stop"))
+    {
+        const char *msg = "Program terminating.\n";
+        send_to_client(msg, strlen(msg), from, from_len);
+        if (stop) atomic_store(stop, true);   
+        return true; 
+    }
+
+
+    else
+    {
+        // Echo at most UDP_ECHO_COMMAND bytes of the command back.
+        char msg[96];
+        int m = snprintf(msg, sizeof(msg), "Unknown: \"%.*s\". Try 'help'.\n",
+                         UDP_ECHO_COMMAND, cmd);
+        send_to_client(msg, reply_len(m, sizeof(msg)), from, from_len);
+    }
+
+    return false;
+}
+
+static void *worker(void *unused)
+{
+
 
-         else if (!strcmp(cmd, "length"))
+    (void)unused;
+    running= true;
+    Rt_applyToSelf("udp", &thread_config);
+
+    static struct mmsghdr msgs[UDP_RECV_BATCH];
+    static struct iovec iov[UDP_RECV_BATCH];
+    static struct sockaddr_storage from[UDP_RECV_BATCH];
+    static char buf[UDP_RECV_BATCH][UDP_MAX_COMMAND];
+
+    bool done = false;
+    while(!done)
+    {
+        if(stop && atomic_load(stop))
         {
-            length((struct sockaddr *)&from, from_len);
-            snprintf(command, sizeof(command), "length");
+            break;
         }
 
-         else if (!strcmp(cmd, "dips"))
+        struct epoll_event events[2];
+        int ready = epoll_wait(epoll_fd, events, 2, -1);
+        if (ready < 0)
         {
-            dips((struct sockaddr *)&from, from_len);
-            snprintf(command, sizeof(command), "dips");
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
         }
 
-        else if (!strcmp(cmd, "history"))
+        bool readable = false;
+        for (int e = 0; e < ready; e++)
         {
-            send_history((struct sockaddr *)&from, from_len);
-            snprintf(command, sizeof(command), "history");
+            if (events[e].data.fd == wake_fd)
+            {
+                done = true;     // udp_stop()
+            }
+            else if (events[e].data.fd == sock)
+            {
+                readable = true;
+            }
         }
 
-        else if (!strcmp(cmd, "stop"))
+        // Drain the whole burst of commands, one recvmmsg() per batch.
+        while (readable && !done)
         {
-            const char *msg = "Program terminating.\n";
-            send_to_client(msg, strlen(msg), (struct sockaddr *)&from, from_len);
-            if (stop) atomic_store(stop, true);   
-            break; 
-        }
+            for (int i = 0; i < UDP_RECV_BATCH; i++)
+            {
+                iov[i].iov_base = buf[i];
+                iov[i].iov_len  = sizeof(buf[i]) - 1;
+                memset(&msgs[i], 0, sizeof(msgs[i]));
+                msgs[i].msg_hdr.msg_name    = &from[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+                msgs[i].msg_hdr.msg_iov     = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen  = 1;
+            }
+
+            int n = recvmmsg(sock, msgs, UDP_RECV_BATCH, MSG_DONTWAIT, NULL);
+            if (n <= 0)
+            {
+                break;      // EAGAIN: drained (EINTR: epoll will wake us again)
+            }
 
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            long long now_ns = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 
-        else
-        {
-            char msg[96];
-            int m = snprintf(msg, sizeof(msg), "Unknown: \"%s\". Try 'help'.\n", cmd);
-            send_to_client(msg, (size_t)m,(struct sockaddr *)&from, from_len);
+            for (int i = 0; i < n && !done; i++)
+            {
+                buf[i][msgs[i].msg_len] = '\0';
+                done = handle_command(buf[i], (struct sockaddr *)&from[i], msgs[i].msg_hdr.msg_namelen, now_ns);
+            }
+            replies_flush();
+
+            readable = (n == UDP_RECV_BATCH);
         }
     }
 
+    replies_flush();
     atomic_store(&running, false);
     return NULL;
 }
 
 
+static void close_fds(void)
+{
+    if (epoll_fd >= 0) { close(epoll_fd); epoll_fd = -1; }
+    if (wake_fd >= 0)  { close(wake_fd);  wake_fd = -1; }
+    if (sock >= 0)     { close(sock);     sock = -1; }
+}
+
+void udp_set_thread_config(const RtThreadConfig *cfg)
+{
+    if (!cfg || atomic_load(&running)) return;
+
+    thread_config = *cfg;
+}
+
 bool udp_start(uint16_t port, _Atomic bool *request_exit)
 {
 
@@ -343,7 +881,7 @@ bool udp_start(uint16_t port, _Atomic bool *request_exit)
 
     stop=  request_exit;
 
-    sock= socket(AF_INET, SOCK_DGRAM,0);
+    sock= socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC,0);
     if(sock <0)
     {
         return false;
@@ -359,18 +897,46 @@ bool udp_start(uint16_t port, _Atomic bool *request_exit)
 
     if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
     {
-        close(sock);
-        sock = -1;
+        close_fds();
+        return false;
+    }
+
+    wake_fd  = eventfd(0, EFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (wake_fd < 0 || epoll_fd < 0)
+    {
+        close_fds();
         return false;
     }
 
-    if (pthread_create(&thr, NULL, worker, NULL) != 0)
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = sock;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0)
     {
-        close(sock);
-        sock = -1;
+        close_fds();
         return false;
     }
+    ev.data.fd = wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0)
+    {
+        close_fds();
+        return false;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    Rt_initAttr(&attr, &thread_config);
+
     atomic_store(&running, true);
+    int err = pthread_create(&thr, &attr, worker, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0)
+    {
+        atomic_store(&running, false);
+        close_fds();
+        return false;
+    }
+    thr_started = true;
     return true;
 }
 
@@ -379,32 +945,17 @@ void udp_stop(void)
 {
     if (stop) atomic_store(stop, true);
 
-    if (sock >= 0)
-    {
-        int s = sock;
-        sock = -1;
-        close(s);
-    }
-
-    if (thr)
+    // Wake the worker through its eventfd; the fds are closed only after
+    // it has exited, so it never sees a descriptor vanish under it.
+    if (thr_started)
     {
+        uint64_t one = 1;
+        (void)!write(wake_fd, &one, sizeof(one));
         (void)pthread_join(thr, NULL);
-        thr = 0;
+        thr_started = false;
     }
+    close_fds();
 
     atomic_store(&running, false);
-    have_client = false;
-    command[0] = '\0';
+    udp_clients_reset();
 }
-
-
-
-
-
-
-
-
-
-
-
-
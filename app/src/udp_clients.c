@@ -0,0 +1,272 @@
+#include "udp_clients.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Chained hash over a fixed node pool; chains and the LRU list use
+// indices (-1 = none). Twice as many buckets as nodes keeps chains short.
+#define NUM_BUCKETS (2 * UDP_MAX_CLIENTS)
+#define NONE (-1)
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint32_t hash;
+    bool in_use;
+
+    int chain_next;
+    int lru_prev;           // towards most recently used
+    int lru_next;           // towards least recently used
+
+    char last_command[UDP_CLIENT_COMMAND_LEN];
+    bool subscribed;
+    bool want_history;
+
+    double tokens;
+    long long refill_ns;
+} client_t;
+
+static client_t clients[UDP_MAX_CLIENTS];
+static int buckets[NUM_BUCKETS];
+static int lru_head = NONE;     // most recently used
+static int lru_tail = NONE;     // least recently used
+static bool initialized = false;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a over the address bytes.
+static uint32_t hash_addr(const struct sockaddr *addr, socklen_t len)
+{
+    const uint8_t *p = (const uint8_t *)addr;
+    uint32_t h = 2166136261u;
+    for (socklen_t i = 0; i < len; i++)
+    {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void reset_locked(void)
+{
+    memset(clients, 0, sizeof(clients));
+    for (int i = 0; i < NUM_BUCKETS; i++)
+    {
+        buckets[i] = NONE;
+    }
+    lru_head = NONE;
+    lru_tail = NONE;
+    initialized = true;
+}
+
+static void lru_unlink(int i)
+{
+    client_t *c = &clients[i];
+    if (c->lru_prev != NONE) clients[c->lru_prev].lru_next = c->lru_next;
+    else lru_head = c->lru_next;
+    if (c->lru_next != NONE) clients[c->lru_next].lru_prev = c->lru_prev;
+    else lru_tail = c->lru_prev;
+    c->lru_prev = NONE;
+    c->lru_next = NONE;
+}
+
+static void lru_push_front(int i)
+{
+    client_t *c = &clients[i];
+    c->lru_prev = NONE;
+    c->lru_next = lru_head;
+    if (lru_head != NONE) clients[lru_head].lru_prev = i;
+    lru_head = i;
+    if (lru_tail == NONE) lru_tail = i;
+}
+
+static void chain_remove(int i)
+{
+    int *link = &buckets[clients[i].hash % NUM_BUCKETS];
+    while (*link != NONE)
+    {
+        if (*link == i)
+        {
+            *link = clients[i].chain_next;
+            return;
+        }
+        link = &clients[*link].chain_next;
+    }
+}
+
+// Least recently used client, preferring one that is not subscribed.
+static int pick_victim(void)
+{
+    for (int i = lru_tail; i != NONE; i = clients[i].lru_prev)
+    {
+        if (!clients[i].subscribed) return i;
+    }
+    return lru_tail;
+}
+
+static int find_locked(const struct sockaddr *addr, socklen_t len, uint32_t h)
+{
+    for (int i = buckets[h % NUM_BUCKETS]; i != NONE; i = clients[i].chain_next)
+    {
+        client_t *c = &clients[i];
+        if (c->hash == h && c->addr_len == len && memcmp(&c->addr, addr, (size_t)len) == 0)
+        {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+// Find the client (adding it if `create`), and mark it most recently used.
+static client_t *lookup_locked(const struct sockaddr *addr, socklen_t len, bool create, long long now_ns)
+{
+    if (!initialized) reset_locked();
+    if ((size_t)len > sizeof(struct sockaddr_storage)) return NULL;
+
+    uint32_t h = hash_addr(addr, len);
+    int i = find_locked(addr, len, h);
+    if (i == NONE)
+    {
+        if (!create) return NULL;
+
+        for (int k = 0; k < UDP_MAX_CLIENTS && i == NONE; k++)
+        {
+            if (!clients[k].in_use) i = k;
+        }
+        if (i == NONE)
+        {
+            i = pick_victim();
+            chain_remove(i);
+            lru_unlink(i);
+        }
+
+        client_t *c = &clients[i];
+        memset(c, 0, sizeof(*c));
+        memcpy(&c->addr, addr, (size_t)len);
+        c->addr_len   = len;
+        c->hash       = h;
+        c->in_use     = true;
+        c->tokens     = UDP_RATE_BURST;
+        c->refill_ns  = now_ns;
+        c->chain_next = buckets[h % NUM_BUCKETS];
+        buckets[h % NUM_BUCKETS] = i;
+        c->lru_prev = NONE;
+        c->lru_next = NONE;
+    }
+    else
+    {
+        lru_unlink(i);
+    }
+    lru_push_front(i);
+    return &clients[i];
+}
+
+void udp_clients_reset(void)
+{
+    pthread_mutex_lock(&lock);
+    reset_locked();
+    pthread_mutex_unlock(&lock);
+}
+
+bool udp_clients_admit(const struct sockaddr *addr, socklen_t len, long long now_ns)
+{
+    bool ok = false;
+    pthread_mutex_lock(&lock);
+    client_t *c = lookup_locked(addr, len, true, now_ns);
+    if (c)
+    {
+        double elapsed_s = (double)(now_ns - c->refill_ns) / 1e9;
+        if (elapsed_s > 0.0)
+        {
+            c->tokens += elapsed_s * UDP_RATE_PER_SEC;
+            if (c->tokens > UDP_RATE_BURST) c->tokens = UDP_RATE_BURST;
+            c->refill_ns = now_ns;
+        }
+        if (c->tokens >= 1.0)
+        {
+            c->tokens -= 1.0;
+            ok = true;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+void udp_clients_get_last_command(const struct sockaddr *addr, socklen_t len, char *out, size_t out_len)
+{
+    if (!out || out_len == 0) return;
+
+    out[0] = '\0';
+    pthread_mutex_lock(&lock);
+    client_t *c = lookup_locked(addr, len, false, 0);
+    if (c)
+    {
+        snprintf(out, out_len, "%s", c->last_command);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void udp_clients_set_last_command(const struct sockaddr *addr, socklen_t len, const char *cmd)
+{
+    pthread_mutex_lock(&lock);
+    client_t *c = lookup_locked(addr, len, false, 0);
+    if (c)
+    {
+        snprintf(c->last_command, sizeof(c->last_command), "%s", cmd);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+bool udp_clients_subscribe(const struct sockaddr *addr, socklen_t len, bool want_history, int max_subscribers)
+{
+    bool ok = false;
+    pthread_mutex_lock(&lock);
+    client_t *c = lookup_locked(addr, len, false, 0);
+    if (c)
+    {
+        int others = 0;
+        for (int i = 0; i < UDP_MAX_CLIENTS; i++)
+        {
+            if (clients[i].in_use && clients[i].subscribed && &clients[i] != c) others++;
+        }
+        if (others < max_subscribers)
+        {
+            c->subscribed   = true;
+            c->want_history = want_history;
+            ok = true;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+void udp_clients_unsubscribe(const struct sockaddr *addr, socklen_t len)
+{
+    pthread_mutex_lock(&lock);
+    client_t *c = lookup_locked(addr, len, false, 0);
+    if (c)
+    {
+        c->subscribed   = false;
+        c->want_history = false;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int udp_clients_get_subscribers(udp_subscriber_t *out, int max)
+{
+    int n = 0;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < UDP_MAX_CLIENTS && n < max; i++)
+    {
+        if (clients[i].in_use && clients[i].subscribed)
+        {
+            memcpy(&out[n].addr, &clients[i].addr, (size_t)clients[i].addr_len);
+            out[n].addr_len     = clients[i].addr_len;
+            out[n].want_history = clients[i].want_history;
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return n;
+}
@@ -0,0 +1,63 @@
+// test.c
+// Runs every test section (or the ones named on the command line).
+#include "test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int Test_check(bool ok, const char *what, const char *file, int line)
+{
+    if (ok) return 0;
+    printf("  %s:%d: check failed: %s\n", file, line, what);
+    return 1;
+}
+
+int Test_checkEq(long long actual, long long expected, const char *what,
+                 const char *file, int line)
+{
+    if (actual == expected) return 0;
+    printf("  %s:%d: %s is %lld, expected %lld\n", file, line, what, actual, expected);
+    return 1;
+}
+
+// Section names; app/CMakeLists.txt registers each one with ctest.
+static const struct {
+    const char *name;
+    int (*run)(void);
+} sections[] = {
+    { "history",   Test_history },
+    { "journal",   Test_journal },
+    { "baseline",  Test_baseline },
+    { "decimator", Test_decimator },
+    { "flicker",   Test_flicker },
+};
+
+#define NUM_SECTIONS ((int)(sizeof(sections) / sizeof(sections[0])))
+
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    int ran = 0;
+    for (int i = 0; i < NUM_SECTIONS; i++)
+    {
+        int selected = (argc < 2);
+        for (int a = 1; a < argc; a++)
+        {
+            if (!strcmp(argv[a], sections[i].name)) selected = 1;
+        }
+        if (!selected) continue;
+
+        printf("[%s]\n", sections[i].name);
+        int failed = sections[i].run();
+        printf("  %s\n", failed ? "FAILED" : "ok");
+        failures += failed;
+        ran++;
+        fflush(stdout);
+    }
+    if (ran == 0)
+    {
+        fprintf(stderr, "no such test section\n");
+        return 2;
+    }
+    return failures ? 1 : 0;
+}
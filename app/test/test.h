@@ -0,0 +1,27 @@
+// test.h
+// Unit tests for the app modules: exact-value checks that run on the host
+// without hardware (the light sensor is the simulated one). Each section
+// is registered with ctest on its own.
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdbool.h>
+
+// Check a condition or an integer equality. On failure, print where and
+// what, and return 1 so the caller can count it: failures += CHECK(x).
+#define CHECK(cond) Test_check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(actual, expected) \
+    Test_checkEq((long long)(actual), (long long)(expected), #actual, __FILE__, __LINE__)
+
+int Test_check(bool ok, const char *what, const char *file, int line);
+int Test_checkEq(long long actual, long long expected, const char *what,
+                 const char *file, int line);
+
+// Test sections; each returns the number of failed checks.
+int Test_history(void);
+int Test_journal(void);
+int Test_baseline(void);
+int Test_decimator(void);
+int Test_flicker(void);
+
+#endif
@@ -0,0 +1,72 @@
+// test_baseline.c
+// Exact Q16 values of the EMA, median and trimmed-mean baselines.
+#include "test.h"
+#include "baseline.h"
+#include "dip_detector.h"
+
+#define TEST_RATE_HZ 1000
+
+static int test_ema(void)
+{
+    int failures = 0;
+    BaselineConfig cfg = Baseline_default();
+    cfg.kind   = BASELINE_EMA;
+    cfg.tau_ms = 10.0;      // alpha = 1 - exp(-0.1) at 1 kHz
+    Baseline b;
+    if (CHECK(Baseline_init(&b, &cfg, TEST_RATE_HZ))) return 1;
+    failures += CHECK_EQ(b.alpha_q32, 408720177);
+
+    // The first sample primes the average exactly.
+    Baseline_push(&b, 1000, false);
+    failures += CHECK_EQ(Baseline_valueQ16(&b), 1000 << DIP_Q16_SHIFT);
+
+    // value += round(alpha * (2000 - value)), in Q16.
+    static const int32_t expected[] = { 71772575, 77415661, 82521737, 87141905, 91322406 };
+    for (int i = 0; i < (int)(sizeof(expected) / sizeof(expected[0])); i++)
+    {
+        Baseline_push(&b, 2000, false);
+        failures += CHECK_EQ(Baseline_valueQ16(&b), expected[i]);
+    }
+    // It settles where a step rounds to zero: 5 Q16 units short.
+    for (int i = 0; i < 2000; i++) Baseline_push(&b, 2000, false);
+    failures += CHECK_EQ(Baseline_valueQ16(&b), (2000 << DIP_Q16_SHIFT) - 5);
+    Baseline_free(&b);
+    return failures;
+}
+
+static int test_windowed(BaselineKind kind)
+{
+    int failures = 0;
+    BaselineConfig cfg = Baseline_default();
+    cfg.kind      = kind;
+    cfg.window_ms = 10.0;   // 10 samples at 1 kHz
+    cfg.trim      = 0.10;   // one sample off each end of a full window
+    Baseline b;
+    if (CHECK(Baseline_init(&b, &cfg, TEST_RATE_HZ))) return 1;
+    failures += CHECK_EQ(b.window, 10);
+
+    // Half a window, 1..5: too few samples to trim, so the plain mean 3
+    // (the median is 3 as well).
+    for (int code = 1; code <= 5; code++) Baseline_push(&b, (uint16_t)code, false);
+    failures += CHECK_EQ(Baseline_valueQ16(&b), 3 << DIP_Q16_SHIFT);
+
+    // 1..9 and an outlier of 100: median (5 + 6) / 2, trimmed mean of
+    // 2..9 = 44 / 8. Both are 5.5.
+    for (int code = 6; code <= 9; code++) Baseline_push(&b, (uint16_t)code, false);
+    Baseline_push(&b, 100, false);
+    failures += CHECK_EQ(Baseline_valueQ16(&b), 11 << (DIP_Q16_SHIFT - 1));
+
+    // 200 pushes 1 out of the window: 2..9, 100, 200. Median (6 + 7) / 2;
+    // trimmed mean of 3..9 and 100 = 142 / 8.
+    Baseline_push(&b, 200, false);
+    int32_t want = kind == BASELINE_MEDIAN ? 13 << (DIP_Q16_SHIFT - 1)
+                                           : (142 << DIP_Q16_SHIFT) / 8;
+    failures += CHECK_EQ(Baseline_valueQ16(&b), want);
+    Baseline_free(&b);
+    return failures;
+}
+
+int Test_baseline(void)
+{
+    return test_ema() + test_windowed(BASELINE_MEDIAN) + test_windowed(BASELINE_TRIMMED);
+}
@@ -0,0 +1,96 @@
+// test_decimator.c
+// Step responses of the CIC and FIR decimators, code for code.
+#include "test.h"
+#include "decimator.h"
+
+#define TEST_RATE_HZ 4000   // factor 4 down to 1 kHz
+#define LOW   1000
+#define HIGH  3000
+
+// `low_inputs` of LOW then HIGH up to `n` inputs, in blocks of 3 so the
+// decimation phase crosses block boundaries.
+static int run_step(Decimator *d, int n, int low_inputs, uint16_t *out)
+{
+    uint16_t in[3];
+    int m = 0;
+    for (int i = 0; i < n; i += 3)
+    {
+        int k = n - i < 3 ? n - i : 3;
+        for (int j = 0; j < k; j++) in[j] = i + j < low_inputs ? LOW : HIGH;
+        m += Decimator_process(d, in, k, out + m);
+    }
+    return m;
+}
+
+static int test_cic(void)
+{
+    int failures = 0;
+    DecimatorConfig cfg = Decimator_default();
+    cfg.kind      = DECIMATOR_CIC;
+    cfg.factor    = 4;
+    cfg.cic_order = 3;
+    Decimator d;
+    if (CHECK(Decimator_init(&d, &cfg, TEST_RATE_HZ))) return 1;
+    failures += CHECK_EQ(d.gain, 64);
+
+    // Output m follows input 4m + 3, and sinc^3 of factor 4 has the
+    // impulse response 1 3 6 10 12 12 10 6 3 1 (sum 64), so the step
+    // from input 8 comes out as (64000 + 2000 * partial sums + 32) / 64.
+    static const uint16_t expected[] = { 1000, 1000, 1625, 2875, 3000, 3000 };
+    uint16_t out[8];
+    int m = run_step(&d, 24, 8, out);
+    failures += CHECK_EQ(m, 6);
+    for (int i = 0; i < m && i < 6; i++)
+    {
+        failures += CHECK_EQ(out[i], expected[i]);
+    }
+    Decimator_free(&d);
+    return failures;
+}
+
+static int test_fir(void)
+{
+    int failures = 0;
+    DecimatorConfig cfg = Decimator_default();
+    cfg.kind           = DECIMATOR_FIR;
+    cfg.factor         = 4;
+    cfg.taps_per_phase = 8;
+    Decimator d;
+    if (CHECK(Decimator_init(&d, &cfg, TEST_RATE_HZ))) return 1;
+    failures += CHECK_EQ(d.taps, 32);
+
+    // Unity DC gain: the Q15 taps sum to exactly 1.
+    int32_t sum = 0;
+    for (int k = 0; k < d.taps; k++) sum += d.coef[k];
+    failures += CHECK_EQ(sum, 1 << 15);
+
+    // Primed at LOW, an output is exactly LOW until the step reaches the
+    // filter and exactly HIGH once all 32 taps see it. In between it is
+    // the rounded Q15 dot product of the taps (oldest first) with the
+    // inputs ending at 4i + 3.
+    enum { N = 96, STEP = 32 };
+    uint16_t out[N / 4 + 1];
+    int m = run_step(&d, N, STEP, out);
+    failures += CHECK_EQ(m, N / 4);
+    for (int i = 0; i < m; i++)
+    {
+        int last_input = 4 * i + 3;
+        int32_t acc = 0;
+        for (int k = 0; k < d.taps; k++)
+        {
+            int j = last_input - (d.taps - 1) + k;
+            acc += d.coef[k] * (j < STEP ? LOW : HIGH);
+        }
+        int want = (acc + (1 << 14)) >> 15;
+        if (last_input < STEP) want = LOW;
+        if (last_input >= STEP + d.taps - 1) want = HIGH;
+        failures += CHECK_EQ(out[i], want < 0 ? 0 : want > 4095 ? 4095 : want);
+    }
+    Decimator_free(&d);
+    return failures;
+}
+
+int Test_decimator(void)
+{
+    return test_cic() + test_fir();
+}
@@ -0,0 +1,93 @@
+// test_flicker.c
+// FFT and Goertzel bin placement: a tone centred on a bin, with evenly
+// spaced and with bunched timestamps, and an alias above Nyquist.
+#include "test.h"
+#include "flicker.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define TEST_RATE_HZ 1000
+#define TEST_SAMPLES 1024       // one FFT frame: bin k is k * 1000 / 1024 Hz
+#define TONE_BIN     100
+#define TONE_HZ      (TONE_BIN * (double)TEST_RATE_HZ / TEST_SAMPLES)
+#define TONE_CODES   200.0
+
+static sample_t samples[TEST_SAMPLES];
+static uint32_t offsets[TEST_SAMPLES];
+
+static sample_t level(double code)
+{
+#ifdef SAMPLER_FIXED_POINT
+    return (sample_t)lround(code);
+#else
+    return code * 3.3 / 4096.0;
+#endif
+}
+
+// The tone at `hz`, sampled at the given offsets (µs).
+static void make_tone(double hz)
+{
+    for (int i = 0; i < TEST_SAMPLES; i++)
+    {
+        samples[i] = level(2048.0 + TONE_CODES * sin(2.0 * M_PI * hz * offsets[i] * 1e-6));
+    }
+}
+
+static int check_method(FlickerMethod m, const Sampler_snapshot_t *snap,
+                        double expected_hz, double want_hz)
+{
+    int failures = 0;
+    if (CHECK(Flicker_init(m, TEST_SAMPLES))) return 1;
+    Flicker_result_t r;
+    failures += CHECK(Flicker_analyze(snap, expected_hz, &r));
+    failures += CHECK_EQ(r.rate_hz, TEST_RATE_HZ);
+    // Within a hundredth of a bin.
+    if (fabs(r.freq_hz - want_hz) > 0.01 * TEST_RATE_HZ / TEST_SAMPLES)
+    {
+        printf("  %s found %.4f Hz, expected %.4f Hz\n", Flicker_methodName(m), r.freq_hz, want_hz);
+        failures++;
+    }
+    Flicker_cleanup();
+    return failures;
+}
+
+int Test_flicker(void)
+{
+    int failures = 0;
+    Sampler_snapshot_t snap = {
+        .samples = samples, .offsets_us = offsets, .size = TEST_SAMPLES, .second = 0,
+        .rate_hz = TEST_RATE_HZ, .num_channels = 1, .channel_stride = TEST_SAMPLES,
+    };
+    static const FlickerMethod methods[] = { FLICKER_GOERTZEL, FLICKER_FFT };
+
+    // Evenly spaced: the peak lands on bin 100.
+    for (int i = 0; i < TEST_SAMPLES; i++) offsets[i] = (uint32_t)i * 1000;
+    make_tone(TONE_HZ);
+    for (int m = 0; m < 2; m++) failures += check_method(methods[m], &snap, TONE_HZ, TONE_HZ);
+
+    // Bunched like a batched SPI read (pairs 100 µs apart, 2 ms ticks): the
+    // resampled grid still puts the peak on bin 100.
+    for (int i = 0; i < TEST_SAMPLES; i++) offsets[i] = (uint32_t)(i / 2) * 2000 + (uint32_t)(i % 2) * 100;
+    make_tone(TONE_HZ);
+    snap.size = TEST_SAMPLES;
+    for (int m = 0; m < 2; m++) failures += check_method(methods[m], &snap, TONE_HZ, TONE_HZ);
+
+    // Above Nyquist: 1000 + f shows up at f, and is flagged.
+    for (int i = 0; i < TEST_SAMPLES; i++) offsets[i] = (uint32_t)i * 1000;
+    make_tone(TEST_RATE_HZ + TONE_HZ);
+    if (!CHECK(Flicker_init(FLICKER_GOERTZEL, TEST_SAMPLES)))
+    {
+        Flicker_result_t r;
+        Flicker_analyze(&snap, TEST_RATE_HZ + TONE_HZ, &r);
+        failures += CHECK(r.aliased);
+        failures += CHECK(fabs(r.alias_hz - TONE_HZ) < 1e-9);
+        failures += CHECK(fabs(r.freq_hz - TONE_HZ) < 0.01 * TEST_RATE_HZ / TEST_SAMPLES);
+        Flicker_cleanup();
+    }
+    return failures;
+}
@@ -0,0 +1,236 @@
+// test_journal.c
+// Journal round trip: every second written to a segment reads back with
+// the same header fields, codes and offsets as the sampler's snapshot,
+// across rotations and after a rotation that failed.
+#define _POSIX_C_SOURCE 200809L
+#include "test.h"
+#include "journal.h"
+#include "sampler.h"
+#include "periodTimer.h"
+#include "hal/light_sensor.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_SECONDS 4
+#define TEST_SEGMENT_BYTES (64 * 1024)
+#define SMALL_SEGMENT_BYTES 4096    // one page: a few seconds at 1 kHz
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = len > 0 ? malloc((size_t)len) : NULL;
+    if (buf && fread(buf, 1, (size_t)len, f) != (size_t)len)
+    {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *size = buf ? (size_t)len : 0;
+    return buf;
+}
+
+// Compare each record of one segment with the sampler's copy of that
+// second. Returns the failures; counts the records in *records.
+static int check_segment(const uint8_t *map, size_t size, int *records)
+{
+    int failures = 0;
+    journal_segment_header_t h;
+    if (CHECK(size >= sizeof(h))) return 1;
+    memcpy(&h, map, sizeof(h));
+    failures += CHECK_EQ(h.magic, JOURNAL_SEGMENT_MAGIC);
+    failures += CHECK_EQ(h.version, JOURNAL_VERSION);
+    failures += CHECK_EQ(h.header_bytes, sizeof(h));
+    failures += CHECK_EQ(h.segment_bytes, size);
+    failures += CHECK_EQ(h.sample_rate_hz, Sampler_getSampleRate());
+    failures += CHECK(h.used_bytes <= size);
+    if (failures) return failures;
+
+    size_t pos = (h.header_bytes + 7) & ~(size_t)7;
+    uint32_t count = 0;
+    while (pos + sizeof(journal_record_header_t) <= h.used_bytes)
+    {
+        journal_record_header_t rec;
+        memcpy(&rec, map + pos, sizeof(rec));
+        failures += CHECK_EQ(rec.magic, JOURNAL_RECORD_MAGIC);
+        failures += CHECK_EQ(rec.record_bytes, JOURNAL_RECORD_BYTES(rec.count));
+        if (failures || pos + rec.record_bytes > h.used_bytes) return failures + 1;
+
+        Sampler_snapshot_t snap;
+        failures += CHECK(Sampler_acquireSecond(rec.second, &snap));
+        failures += CHECK_EQ(rec.start_ns, snap.start_ns);
+        failures += CHECK_EQ(rec.count, snap.size);
+        failures += CHECK_EQ(rec.dips, snap.dips);
+        const uint8_t *codes = map + pos + JOURNAL_CODES_OFFSET;
+        const uint8_t *offsets = map + pos + JOURNAL_OFFSETS_OFFSET(rec.count);
+        for (uint32_t i = 0; i < rec.count && i < (uint32_t)snap.size; i++)
+        {
+            uint16_t code;
+            uint32_t off;
+            memcpy(&code, codes + 2 * i, sizeof(code));
+            memcpy(&off, offsets + 4 * i, sizeof(off));
+            if (CHECK_EQ(code, Sampler_toCode(snap.samples[i]))
+                + CHECK_EQ(off, snap.offsets_us[i]))
+            {
+                failures++;
+                break;
+            }
+        }
+        Sampler_releaseHistory(&snap);
+        pos += rec.record_bytes;
+        count++;
+    }
+    failures += CHECK_EQ(pos, h.used_bytes);
+    failures += CHECK_EQ(count, h.record_count);
+    *records += (int)count;
+    return failures;
+}
+
+static void close_second(long ms)
+{
+    struct timespec ts = { 0, ms * 1000000L };
+    nanosleep(&ts, NULL);
+    Sampler_moveCurrentDataToHistory();
+}
+
+// Check and delete every segment in `dir`. Counts records and segments.
+static int check_dir(const char *dir, int *records, int *segments)
+{
+    int failures = 0;
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL)
+    {
+        if (e->d_name[0] == '.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        size_t size;
+        uint8_t *map = read_file(path, &size);
+        failures += CHECK(map != NULL);
+        if (map) failures += check_segment(map, size, records);
+        free(map);
+        unlink(path);
+        (*segments)++;
+    }
+    if (d) closedir(d);
+    return failures;
+}
+
+static int test_round_trip(const char *dir)
+{
+    int failures = 0;
+    JournalConfig cfg = { dir, TEST_SEGMENT_BYTES, 0 };
+    if (CHECK(Journal_start(&cfg))) return 1;
+    for (int s = 0; s < TEST_SECONDS; s++) close_second(50);
+    Journal_stop();
+
+    Journal_stats_t stats;
+    Journal_getStats(&stats);
+    failures += CHECK_EQ(stats.seconds_written, TEST_SECONDS);
+    failures += CHECK_EQ(stats.seconds_missed, 0);
+
+    // Read back while the sampler still holds those seconds.
+    int records = 0, segments = 0;
+    failures += check_dir(dir, &records, &segments);
+    failures += CHECK_EQ(records, TEST_SECONDS);
+    failures += CHECK_EQ(segments, 1);
+    return failures;
+}
+
+// ~150 samples (under 1 KiB) per second: a page holds four.
+static int test_rotation(const char *dir)
+{
+    enum { SECONDS = 10 };
+    int failures = 0;
+    JournalConfig cfg = { dir, SMALL_SEGMENT_BYTES, 0 };
+    if (CHECK(Journal_start(&cfg))) return 1;
+    for (int s = 0; s < SECONDS; s++) close_second(150);
+    Journal_stop();
+
+    Journal_stats_t stats;
+    Journal_getStats(&stats);
+    failures += CHECK_EQ(stats.seconds_written, SECONDS);
+    failures += CHECK_EQ(stats.seconds_missed, 0);
+    failures += CHECK(stats.segment_index >= 2);
+
+    int records = 0, segments = 0;
+    failures += check_dir(dir, &records, &segments);
+    failures += CHECK_EQ(records, SECONDS);
+    failures += CHECK(segments >= 3);
+    return failures;
+}
+
+// Remove the directory under the open segment so the next rotation
+// fails, let several seconds queue behind it, then bring the directory
+// back: the journal must count the lost seconds and resume.
+static int test_failed_rotation(const char *dir)
+{
+    int failures = 0;
+    JournalConfig cfg = { dir, SMALL_SEGMENT_BYTES, 0 };
+    if (CHECK(Journal_start(&cfg))) return 1;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/journal-%06d.seg", dir, 0);
+    unlink(path);
+    rmdir(dir);
+
+    close_second(500);      // ~3 KiB: fills most of the first segment
+    close_second(300);      // ~300 ms later: does not fit, rotation fails
+    close_second(0);        // queued behind the failure
+    close_second(0);
+    close_second(300);      // no directory yet: the retry fails too
+    mkdir(dir, 0700);
+    close_second(300);      // written to a fresh segment
+    close_second(300);
+    Journal_stop();
+
+    Journal_stats_t stats;
+    Journal_getStats(&stats);
+    failures += CHECK_EQ(stats.seconds_written + stats.seconds_missed, 7);
+    failures += CHECK(stats.seconds_missed >= 3);
+    failures += CHECK(stats.seconds_written >= 2);
+
+    int records = 0, segments = 0;
+    failures += check_dir(dir, &records, &segments);
+    failures += CHECK(records >= 1);
+    failures += CHECK(segments >= 1);
+    return failures;
+}
+
+int Test_journal(void)
+{
+    char dir[] = "/tmp/journal-test-XXXXXX";
+    if (!mkdtemp(dir)) return 1;
+
+    Period_init();
+    if (LightSensor_Init("sim:noise=0.05,dip_every=300,dip_len=20,dip_depth=0.5,rate=1000", 0, 3.3) != 0)
+    {
+        Period_cleanup();
+        return 1;
+    }
+    if (!Sampler_initWithRate(SAMPLER_DEFAULT_RATE_HZ))
+    {
+        LightSensor_Close();
+        Period_cleanup();
+        return 1;
+    }
+
+    int failures = test_round_trip(dir)
+                 + test_rotation(dir)
+                 + test_failed_rotation(dir);
+    rmdir(dir);
+
+    Sampler_cleanup();
+    LightSensor_Close();
+    Period_cleanup();
+    return failures;
+}
@@ -0,0 +1,503 @@
+// dip_replay.c
+// Run the dip detector offline over recorded captures, to tune DipConfig
+// against real data.
+//   dip_replay [options] <capture>...
+// A capture is either a journal segment (journal-NNNNNN.seg, detected by
+// its magic) or CSV: one sample per line, volts in the first field, or in
+// the `volts` column when there is a header (journal_dump --csv output;
+// its `second` column then groups the samples). Each file is its own
+// stream, replayed the way the sampler runs live: the samples go through
+// the same decimation stage (--decim*), then each filtered sample is
+// judged against the same baseline module (--baseline*) and folded into it.
+// CSV is read through a sliding mmap window, so file size is not limited
+// by memory; several files are replayed in parallel with --jobs.
+#define _POSIX_C_SOURCE 200809L
+#include "baseline.h"
+#include "decimator.h"
+#include "dip_detector.h"
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// CSV mmap window (a multiple of the page size).
+#define CSV_CHUNK_BYTES (64u * 1024 * 1024)
+#define CSV_MAX_LINE    256
+#define CSV_MAX_FIELDS  8
+// Raw samples filtered per Decimator_process() call.
+#define DECIM_BLOCK     1024
+
+typedef struct {
+    long long second;
+    int samples;
+    int dips;
+    int live_dips;          // as recorded by the sampler (-1: unknown)
+} second_result_t;
+
+typedef struct {
+    const char *path;
+    bool ok;
+    long long bytes;
+    long long samples;
+    long long dips;
+    long long live_dips;    // -1 when the capture does not record them
+    double elapsed_s;
+
+    second_result_t *seconds;
+    int num_seconds;
+    int cap_seconds;
+} replay_result_t;
+
+// One file's detector state.
+typedef struct {
+    Decimator decimator;
+    DipStream dip;
+    Baseline baseline;
+    double volts_per_code;
+    replay_result_t *res;
+    second_result_t cur;    // second being accumulated
+    bool in_second;
+} replay_t;
+
+static DipConfig dip_config;
+static BaselineConfig baseline_config;
+static DecimatorConfig decimator_config;
+static int csv_rate_hz = 1000;
+static double csv_vref = 3.3;
+static bool per_second = false;
+
+static replay_result_t *results;
+static int num_files;
+static _Atomic int next_file = 0;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void second_end(replay_t *r)
+{
+    if (!r->in_second) return;
+
+    replay_result_t *res = r->res;
+    if (per_second)
+    {
+        if (res->num_seconds == res->cap_seconds)
+        {
+            int cap = res->cap_seconds ? 2 * res->cap_seconds : 64;
+            second_result_t *grown = realloc(res->seconds, (size_t)cap * sizeof(*grown));
+            if (!grown)
+            {
+                r->in_second = false;   // out of memory: totals only
+                return;
+            }
+            res->seconds = grown;
+            res->cap_seconds = cap;
+        }
+        res->seconds[res->num_seconds++] = r->cur;
+    }
+    r->in_second = false;
+}
+
+static void second_begin(replay_t *r, long long second, int live_dips)
+{
+    second_end(r);
+    r->cur.second    = second;
+    r->cur.samples   = 0;
+    r->cur.dips      = 0;
+    r->cur.live_dips = live_dips;
+    r->in_second     = true;
+}
+
+// Filter raw codes, then judge each filtered sample against the baseline
+// and fold it in (as sampler.c does).
+static void push(replay_t *r, const uint16_t *codes, int n)
+{
+    uint16_t filtered[DECIM_BLOCK];
+    for (int i = 0; i < n; i += DECIM_BLOCK)
+    {
+        int take = n - i < DECIM_BLOCK ? n - i : DECIM_BLOCK;
+        int m = Decimator_process(&r->decimator, codes + i, take, filtered);
+        for (int j = 0; j < m; j++)
+        {
+            if (r->baseline.primed)
+            {
+                double ave = (double)Baseline_valueQ16(&r->baseline) / DIP_Q16_ONE * r->volts_per_code;
+                int d = Dip_streamPush(&r->dip, filtered[j] * r->volts_per_code, ave);
+                r->cur.dips += d;
+                r->res->dips += d;
+            }
+            Baseline_push(&r->baseline, filtered[j], Dip_streamInDip(&r->dip));
+        }
+    }
+    r->cur.samples += n;
+    r->res->samples += n;
+}
+
+static bool replay_begin(replay_t *r, int rate_hz, double volts_per_code)
+{
+    r->volts_per_code = volts_per_code;
+    if (rate_hz <= 0) rate_hz = csv_rate_hz;
+    if (!Decimator_init(&r->decimator, &decimator_config, rate_hz)
+        || !Baseline_init(&r->baseline, &baseline_config, rate_hz / Decimator_factor(&r->decimator)))
+    {
+        fprintf(stderr, "%s: out of memory for the filter state\n", r->res->path);
+        return false;
+    }
+    Dip_streamInit(&r->dip, &dip_config, r->decimator.out_rate_hz);
+    return true;
+}
+
+static bool replay_journal(replay_t *r, const uint8_t *map, size_t size)
+{
+    journal_segment_header_t h;
+    memcpy(&h, map, sizeof(h));
+    if (h.version != JOURNAL_VERSION)
+    {
+        fprintf(stderr, "%s: unsupported journal version %u\n", r->res->path, h.version);
+        return false;
+    }
+    size_t used = h.used_bytes < size ? (size_t)h.used_bytes : size;
+    // The segment is preallocated; only the written part counts.
+    r->res->bytes = (long long)used;
+    r->res->live_dips = 0;
+    if (!replay_begin(r, (int)h.sample_rate_hz, h.volts_per_code))
+    {
+        return false;
+    }
+
+    size_t pos = (h.header_bytes + 7) & ~(size_t)7;
+    while (pos + sizeof(journal_record_header_t) <= used)
+    {
+        journal_record_header_t rec;
+        memcpy(&rec, map + pos, sizeof(rec));
+        if (rec.magic != JOURNAL_RECORD_MAGIC || rec.record_bytes != JOURNAL_RECORD_BYTES(rec.count)
+            || pos + rec.record_bytes > used)
+        {
+            fprintf(stderr, "%s: bad record at byte %zu\n", r->res->path, pos);
+            return false;
+        }
+        const uint16_t *codes = (const uint16_t *)(map + pos + JOURNAL_CODES_OFFSET);
+
+        second_begin(r, rec.second, (int)rec.dips);
+        r->res->live_dips += rec.dips;
+        push(r, codes, (int)rec.count);
+        pos += rec.record_bytes;
+    }
+    second_end(r);
+    return true;
+}
+
+// CSV layout, from the header line (if any).
+typedef struct {
+    int volts_col;
+    int second_col;         // -1: group by sample index / csv_rate_hz
+    bool header_seen;
+    long long index;
+} csv_state_t;
+
+static int split_fields(char *line, char **fields)
+{
+    int n = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, ",", &save); tok && n < CSV_MAX_FIELDS;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        fields[n++] = tok;
+    }
+    return n;
+}
+
+static void csv_line(replay_t *r, csv_state_t *cs, const char *p, size_t len)
+{
+    char line[CSV_MAX_LINE];
+    if (len >= sizeof(line)) len = sizeof(line) - 1;
+    memcpy(line, p, len);
+    line[len] = '\0';
+    if (len > 0 && line[len - 1] == '\r') line[len - 1] = '\0';
+    if (line[0] == '#' || line[0] == '\0') return;
+
+    char *fields[CSV_MAX_FIELDS];
+    int n = split_fields(line, fields);
+    if (n == 0) return;
+
+    if (!cs->header_seen)
+    {
+        cs->header_seen = true;
+        char *end;
+        strtod(fields[0], &end);
+        if (end == fields[0])
+        {
+            for (int i = 0; i < n; i++)
+            {
+                if (!strcmp(fields[i], "volts"))  cs->volts_col = i;
+                if (!strcmp(fields[i], "second")) cs->second_col = i;
+            }
+            return;
+        }
+    }
+    if (cs->volts_col >= n) return;
+
+    long long second = cs->second_col >= 0 && cs->second_col < n
+                     ? atoll(fields[cs->second_col])
+                     : cs->index / csv_rate_hz;
+    if (!r->in_second || second != r->cur.second)
+    {
+        second_begin(r, second, -1);
+    }
+    double code = strtod(fields[cs->volts_col], NULL) / r->volts_per_code + 0.5;
+    uint16_t c = code <= 0.0 ? 0 : code >= 4095.0 ? 4095 : (uint16_t)code;
+    push(r, &c, 1);
+    cs->index++;
+}
+
+static bool replay_csv(replay_t *r, int fd, size_t size)
+{
+    csv_state_t cs = { .volts_col = 0, .second_col = -1, .header_seen = false, .index = 0 };
+    if (!replay_begin(r, csv_rate_hz, csv_vref / 4096.0))
+    {
+        return false;
+    }
+    char carry[CSV_MAX_LINE];
+    size_t carry_len = 0;
+
+    for (size_t off = 0; off < size; off += CSV_CHUNK_BYTES)
+    {
+        size_t len = size - off < CSV_CHUNK_BYTES ? size - off : CSV_CHUNK_BYTES;
+        const char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, (off_t)off);
+        if (map == MAP_FAILED)
+        {
+            fprintf(stderr, "%s: mmap: %s\n", r->res->path, strerror(errno));
+            return false;
+        }
+        (void)posix_madvise((void *)map, len, POSIX_MADV_SEQUENTIAL);
+
+        const char *p = map, *end = map + len;
+        while (p < end)
+        {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            size_t n = (size_t)((nl ? nl : end) - p);
+            if (carry_len > 0 || !nl)
+            {
+                // A line split across windows is reassembled in `carry`.
+                size_t room = sizeof(carry) - 1 - carry_len;
+                size_t take = n < room ? n : room;
+                memcpy(carry + carry_len, p, take);
+                carry_len += take;
+                if (!nl) break;
+                csv_line(r, &cs, carry, carry_len);
+                carry_len = 0;
+            }
+            else
+            {
+                csv_line(r, &cs, p, n);
+            }
+            p = nl + 1;
+        }
+        munmap((void *)map, len);
+    }
+    if (carry_len > 0)
+    {
+        csv_line(r, &cs, carry, carry_len);
+    }
+    second_end(r);
+    return true;
+}
+
+static void replay_file(replay_result_t *res)
+{
+    double t0 = now_s();
+    res->live_dips = -1;
+
+    int fd = open(res->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", res->path, strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "%s: empty or unreadable\n", res->path);
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    res->bytes = (long long)size;
+
+    replay_t r;
+    memset(&r, 0, sizeof(r));
+    r.res = res;
+
+    uint32_t magic = 0;
+    if (size >= sizeof(journal_segment_header_t) && pread(fd, &magic, sizeof(magic), 0) == sizeof(magic)
+        && magic == JOURNAL_SEGMENT_MAGIC)
+    {
+        // Segments are bounded by the journal's segment size: map whole.
+        const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            fprintf(stderr, "%s: mmap: %s\n", res->path, strerror(errno));
+        }
+        else
+        {
+            res->ok = replay_journal(&r, map, size);
+            munmap((void *)map, size);
+        }
+    }
+    else
+    {
+        res->ok = replay_csv(&r, fd, size);
+    }
+    Baseline_free(&r.baseline);
+    Decimator_free(&r.decimator);
+    close(fd);
+    res->elapsed_s = now_s() - t0;
+}
+
+static void *worker(void *unused)
+{
+    (void)unused;
+    int i;
+    while ((i = atomic_fetch_add(&next_file, 1)) < num_files)
+    {
+        replay_file(&results[i]);
+    }
+    return NULL;
+}
+
+static void print_result(const replay_result_t *res)
+{
+    if (!res->ok)
+    {
+        printf("%s: FAILED\n", res->path);
+        return;
+    }
+    if (per_second)
+    {
+        for (int i = 0; i < res->num_seconds; i++)
+        {
+            const second_result_t *s = &res->seconds[i];
+            printf("%s second=%lld samples=%d dips=%d", res->path, s->second, s->samples, s->dips);
+            if (s->live_dips >= 0) printf(" live=%d", s->live_dips);
+            printf("\n");
+        }
+    }
+    printf("%s: samples=%lld dips=%lld", res->path, res->samples, res->dips);
+    if (res->live_dips >= 0) printf(" (live %lld)", res->live_dips);
+    printf(" %.1f MB in %.3f s (%.1f Msamples/s)\n", res->bytes / 1e6, res->elapsed_s,
+           res->elapsed_s > 0 ? res->samples / res->elapsed_s / 1e6 : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+    dip_config = Dip_default();
+    baseline_config = Baseline_default();
+    decimator_config = Decimator_default();
+    int jobs = 1;
+    int legacy_width = -1, legacy_gap = -1;     // deprecated, in samples
+
+    results = calloc((size_t)argc, sizeof(*results));
+    if (!results) return 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if      (!strncmp(argv[i], "--dip-trig=", 11))  dip_config.trigger_delta = atof(argv[i] + 11);
+        else if (!strncmp(argv[i], "--dip-rel=", 10))   dip_config.release_delta = atof(argv[i] + 10);
+        else if (!strncmp(argv[i], "--dip-width-ms=", 15)) dip_config.min_width_ms = atof(argv[i] + 15);
+        else if (!strncmp(argv[i], "--dip-gap-ms=", 13))   dip_config.min_gap_ms = atof(argv[i] + 13);
+        else if (!strncmp(argv[i], "--dip-width=", 12))
+        {
+            fprintf(stderr, "WARN: --dip-width=<samples> is deprecated; use --dip-width-ms=<ms>\n");
+            legacy_width = atoi(argv[i] + 12);
+        }
+        else if (!strncmp(argv[i], "--dip-gap=", 10))
+        {
+            fprintf(stderr, "WARN: --dip-gap=<samples> is deprecated; use --dip-gap-ms=<ms>\n");
+            legacy_gap = atoi(argv[i] + 10);
+        }
+        else if (!strncmp(argv[i], "--rate=", 7))       csv_rate_hz = atoi(argv[i] + 7);
+        else if (!strncmp(argv[i], "--vref=", 7))       csv_vref = atof(argv[i] + 7);
+        else if (Baseline_parseArg(argv[i], &baseline_config)) continue;
+        else if (Decimator_parseArg(argv[i], &decimator_config)) continue;
+        else if (!strncmp(argv[i], "--jobs=", 7))       jobs = atoi(argv[i] + 7);
+        else if (!strcmp(argv[i], "--per-second"))      per_second = true;
+        else if (argv[i][0] == '-' && argv[i][1] == '-')
+        {
+            fprintf(stderr, "WARN: unknown arg ignored: %s\n", argv[i]);
+        }
+        else results[num_files++].path = argv[i];
+    }
+    if (num_files == 0)
+    {
+        fprintf(stderr,
+"Usage: %s [options] <journal-NNNNNN.seg | capture.csv>...\n"
+"Options:\n"
+"  --dip-trig=<V> --dip-rel=<V>     Trigger/release delta below the baseline (0.10/0.07)\n"
+"  --dip-width-ms=<ms> --dip-gap-ms=<ms>  Min width / gap (2/1)\n"
+"  --rate=<Hz>                      CSV sample rate (1000)\n"
+"  --vref=<V>                       ADC reference the CSV volts were scaled by (3.3)\n"
+BASELINE_USAGE
+DECIMATOR_USAGE
+"  --jobs=<N>                       Files replayed in parallel (default: 1)\n"
+"  --per-second                     Print dips for every second\n",
+            argv[0]);
+        free(results);
+        return 2;
+    }
+    if (csv_rate_hz < 1) csv_rate_hz = 1;
+    // The old flags counted samples; take them at the --rate.
+    if (legacy_width >= 0) dip_config.min_width_ms = legacy_width * 1000.0 / csv_rate_hz;
+    if (legacy_gap >= 0)   dip_config.min_gap_ms = legacy_gap * 1000.0 / csv_rate_hz;
+    if (csv_vref <= 0.0) csv_vref = 3.3;
+    if (jobs < 1) jobs = 1;
+    if (jobs > num_files) jobs = num_files;
+
+    double t0 = now_s();
+    pthread_t *tids = calloc((size_t)jobs, sizeof(*tids));
+    int started = 0;
+    for (int t = 1; tids && t < jobs; t++)
+    {
+        if (pthread_create(&tids[t], NULL, worker, NULL) == 0) started = t;
+        else break;
+    }
+    worker(NULL);
+    for (int t = 1; t <= started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    double wall_s = now_s() - t0;
+
+    long long samples = 0, dips = 0, bytes = 0;
+    int rc = 0;
+    for (int i = 0; i < num_files; i++)
+    {
+        print_result(&results[i]);
+        samples += results[i].samples;
+        dips    += results[i].dips;
+        bytes   += results[i].bytes;
+        if (!results[i].ok) rc = 1;
+        free(results[i].seconds);
+    }
+    printf("total: %d files, samples=%lld dips=%lld, %.1f MB in %.3f s "
+           "(%.1f MB/s, %.1f Msamples/s, %d jobs)\n",
+           num_files, samples, dips, bytes / 1e6, wall_s,
+           wall_s > 0 ? bytes / wall_s / 1e6 : 0.0,
+           wall_s > 0 ? samples / wall_s / 1e6 : 0.0, jobs);
+
+    free(results);
+    return rc;
+}
@@ -0,0 +1,123 @@
+// journal_dump.c
+// Print the contents of journal segment files written by the sampler.
+//   journal_dump [--csv] journal-000000.seg [...]
+// Default output is one line per recorded second; --csv prints every
+// sample as second,t_us,code,volts.
+#define _POSIX_C_SOURCE 200809L
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int dump_segment(const char *path, bool csv)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(journal_segment_header_t))
+    {
+        fprintf(stderr, "%s: too small for a journal segment\n", path);
+        close(fd);
+        return 1;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    int rc = 0;
+    journal_segment_header_t h;
+    memcpy(&h, map, sizeof(h));
+    if (h.magic != JOURNAL_SEGMENT_MAGIC || h.version != JOURNAL_VERSION)
+    {
+        fprintf(stderr, "%s: not a version %d journal segment\n", path, JOURNAL_VERSION);
+        munmap((void *)map, size);
+        return 1;
+    }
+    size_t used = h.used_bytes < size ? (size_t)h.used_bytes : size;
+
+    if (!csv)
+    {
+        printf("# %s: segment %u, %u records, %zu/%zu bytes, %u Hz, %.6f V/code\n",
+               path, h.segment_index, h.record_count, used, size,
+               h.sample_rate_hz, h.volts_per_code);
+    }
+
+    size_t pos = (h.header_bytes + 7) & ~(size_t)7;
+    while (pos + sizeof(journal_record_header_t) <= used)
+    {
+        journal_record_header_t r;
+        memcpy(&r, map + pos, sizeof(r));
+        if (r.magic != JOURNAL_RECORD_MAGIC || r.record_bytes != JOURNAL_RECORD_BYTES(r.count)
+            || pos + r.record_bytes > used)
+        {
+            fprintf(stderr, "%s: bad record at byte %zu\n", path, pos);
+            rc = 1;
+            break;
+        }
+        const uint16_t *codes = (const uint16_t *)(map + pos + JOURNAL_CODES_OFFSET);
+        const uint32_t *t_us  = (const uint32_t *)(map + pos + JOURNAL_OFFSETS_OFFSET(r.count));
+
+        if (csv)
+        {
+            for (uint32_t i = 0; i < r.count; i++)
+            {
+                printf("%lld,%u,%u,%.4f\n", (long long)r.second, t_us[i], codes[i],
+                       codes[i] * h.volts_per_code);
+            }
+        }
+        else
+        {
+            double span_ms = r.count > 1 ? (t_us[r.count - 1] - t_us[0]) / 1000.0 : 0.0;
+            printf("second=%lld start_ns=%lld samples=%u dips=%u span_ms=%.3f\n",
+                   (long long)r.second, (long long)r.start_ns, r.count, r.dips, span_ms);
+        }
+        pos += r.record_bytes;
+    }
+
+    munmap((void *)map, size);
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    bool csv = false;
+    int files = 0;
+    int rc = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--csv")) csv = true;
+    }
+    if (csv)
+    {
+        printf("second,t_us,code,volts\n");
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--csv") != 0)
+        {
+            rc |= dump_segment(argv[i], csv);
+            files++;
+        }
+    }
+    if (files == 0)
+    {
+        fprintf(stderr, "Usage: %s [--csv] <journal-NNNNNN.seg>...\n", argv[0]);
+        return 2;
+    }
+    return rc;
+}
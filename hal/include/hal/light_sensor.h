@@ -3,10 +3,41 @@
 
 #include <stdint.h>
 
+// Most conversions (per channel) queued into a single SPI_IOC_MESSAGE ioctl.
+#define LIGHT_SENSOR_MAX_BATCH 32
+// The MCP3208 has eight single-ended inputs.
+#define LIGHT_SENSOR_MAX_CHANNELS 8
+
+// Passing "sim:<options>" instead of a /dev/spidev path selects a simulated
+// ADC with the same API (for load-testing off-target). Options are
+// comma-separated key=value pairs, e.g.
+//   sim:dc=1.5,noise=0.02,flicker_hz=100,duty=50,dip_every=1000
+// Keys: dc, noise (V peak), flicker_hz, flicker_depth (V), duty (%),
+//       dip_every, dip_len (samples), dip_depth (V),
+//       rate (samples/s the generator assumes; default 1000), seed,
+//       file (replay volts, one per line, looped; overrides the generator)
+// With several channels selected, each sees the same pattern offset by a
+// channel-dependent number of samples.
+#define LIGHT_SENSOR_SIM_PREFIX "sim:"
+
 int  LightSensor_Init(const char *spidev, int channel, double vref_v);
 int  LightSensor_ReadRaw(uint16_t *raw12);
 int  LightSensor_ReadVolts(double *volts);
+// Read n (1..LIGHT_SENSOR_MAX_BATCH) back-to-back conversions with one ioctl.
+int  LightSensor_ReadRawBatch(uint16_t *raw12, int n);
+int  LightSensor_ReadVoltsBatch(double *volts, int n);
 int  LightSensor_ReadVoltsAvg(int n, double *volts_avg);
+// Multi-channel scanning: after Init, select up to LIGHT_SENSOR_MAX_CHANNELS
+// distinct channels (0..7). A scan converts each of them once; reading
+// `scans` (1..LIGHT_SENSOR_MAX_BATCH) scans is still one ioctl, and fills
+// scans * num_channels values interleaved as [scan][channel]. Init selects
+// just its own channel; the single-channel reads above use the first one.
+int  LightSensor_SetChannels(const int *channels, int num_channels);
+int  LightSensor_GetChannels(int *channels, int max_channels);
+int  LightSensor_ReadRawScans(uint16_t *raw12, int scans);
+int  LightSensor_ReadVoltsScans(double *volts, int scans);
+// Volts represented by one ADC code (vref / 4096).
+double LightSensor_VoltsPerCode(void);
 void LightSensor_Close(void);
 
 
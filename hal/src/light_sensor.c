@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 #include "hal/light_sensor.h"
+#include "light_sensor_backend.h"
 
 #include <linux/spi/spidev.h>
 #include <errno.h>
@@ -13,9 +14,13 @@
 
 static int      s_fd     = -1; // file descriptior
 static int      s_ch     = 0;   // chip channel 0    
+static int      s_chs[LIGHT_SENSOR_MAX_CHANNELS] = {0}; // scanned channels (s_chs[0] == s_ch)
+static int      s_num_chs = 1;
 static double   s_vref   = 3.3;   // reference voltage to ADC
 static uint32_t s_speed  = 1000000; // 1 MHz spi freq 
 
+static const LightSensorBackend *s_backend = NULL; // NULL until Init succeeds
+
 static struct spi_ioc_transfer g_tr_tmpl = {
     .len           = 3,
     .speed_hz      = 1000000,   
@@ -24,6 +29,65 @@ static struct spi_ioc_transfer g_tr_tmpl = {
     .delay_usecs   = 0,
 };
 
+// Preallocated batch: one transfer (with CS toggled between) per conversion,
+// enough for LIGHT_SENSOR_MAX_BATCH scans of every channel.
+#define LIGHT_SENSOR_MAX_TRANSFERS (LIGHT_SENSOR_MAX_BATCH * LIGHT_SENSOR_MAX_CHANNELS)
+static struct spi_ioc_transfer g_batch_tr[LIGHT_SENSOR_MAX_TRANSFERS];
+static uint8_t g_batch_tx[LIGHT_SENSOR_MAX_TRANSFERS][3];
+static uint8_t g_batch_rx[LIGHT_SENSOR_MAX_TRANSFERS][3];
+
+// Channel list the command bytes in g_batch_tx were laid out for.
+static int g_batch_chs[LIGHT_SENSOR_MAX_CHANNELS];
+static int g_batch_num_chs = 0;
+
+static void mcp3208_batch_prepare(const int *chs, int num_ch)
+{
+    for (int i = 0; i < LIGHT_SENSOR_MAX_TRANSFERS; ++i) 
+    {
+        int ch = chs[i % num_ch];
+        g_batch_tx[i][0] = 0x06 | ((ch & 0x04) >> 2);
+        g_batch_tx[i][1] = (uint8_t)((ch & 0x03) << 6);
+        g_batch_tx[i][2] = 0x00;
+
+        g_batch_tr[i] = g_tr_tmpl;
+        g_batch_tr[i].tx_buf    = (uintptr_t)g_batch_tx[i];
+        g_batch_tr[i].rx_buf    = (uintptr_t)g_batch_rx[i];
+        g_batch_tr[i].speed_hz  = s_speed;
+        g_batch_tr[i].cs_change = 1;   // release CS so the next conversion starts
+    }
+    memcpy(g_batch_chs, chs, (size_t)num_ch * sizeof(int));
+    g_batch_num_chs = num_ch;
+}
+
+static int mcp3208_xfer_batch(const int *chs, int num_ch, int scans, uint16_t *out12) 
+{
+    if (s_fd < 0 || scans <= 0 || scans > LIGHT_SENSOR_MAX_BATCH || !out12) 
+    {
+        return -1;
+    }
+    // Only rewrite the command bytes when the channel list changes.
+    if (num_ch != g_batch_num_chs || memcmp(chs, g_batch_chs, (size_t)num_ch * sizeof(int)) != 0)
+    {
+        mcp3208_batch_prepare(chs, num_ch);
+    }
+
+    // The last transfer must not leave CS asserted after the message.
+    int n = scans * num_ch;
+    g_batch_tr[n - 1].cs_change = 0;
+    int rc = ioctl(s_fd, SPI_IOC_MESSAGE(n), g_batch_tr);
+    g_batch_tr[n - 1].cs_change = 1;
+    if (rc < 1) 
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < n; ++i) 
+    {
+        out12[i] = ((uint16_t)(g_batch_rx[i][1] & 0x0F) << 8) | g_batch_rx[i][2];
+    }
+    return 0;
+}
+
 static int mcp3208_xfer(int ch, uint16_t *out12) 
 {
     if (s_fd < 0 || ch < 0 || ch > 7 || !out12) 
@@ -51,12 +115,46 @@ static int mcp3208_xfer(int ch, uint16_t *out12)
     return 0;
 }
 
+// MCP3208 on spidev backend.
+static int spi_read(const int *chs, int num_ch, uint16_t *out12, int scans)
+{
+    if (scans == 1 && num_ch == 1) 
+    {
+        return mcp3208_xfer(chs[0], out12);
+    }
+    return mcp3208_xfer_batch(chs, num_ch, scans, out12);
+}
+
+static void spi_close(void)
+{
+    if (s_fd >= 0) { close(s_fd); s_fd = -1; }
+}
+
+static const LightSensorBackend spi_backend = {
+    .read  = spi_read,
+    .close = spi_close,
+};
+
 int LightSensor_Init(const char *spidev, int channel, double vref_v) {
     if (!spidev || channel < 0 || channel > 7 || vref_v <= 0.0) 
     {
         errno = EINVAL; return -1;
     }
 
+    if (!strncmp(spidev, LIGHT_SENSOR_SIM_PREFIX, strlen(LIGHT_SENSOR_SIM_PREFIX))) 
+    {
+        if (LightSensorSim_open(spidev + strlen(LIGHT_SENSOR_SIM_PREFIX), vref_v) < 0) 
+        {
+            return -1;
+        }
+        s_ch = channel;
+        s_chs[0] = channel;
+        s_num_chs = 1;
+        s_vref = vref_v;
+        s_backend = &LightSensorSim_backend;
+        return 0;
+    }
+
     int fd = open(spidev, O_RDWR | O_CLOEXEC);
     if (fd < 0) return -1;
 
@@ -68,29 +166,123 @@ int LightSensor_Init(const char *spidev, int channel, double vref_v) {
 
     s_fd = fd;
     s_ch = channel;
+    s_chs[0] = channel;
+    s_num_chs = 1;
     s_vref = vref_v;
+    mcp3208_batch_prepare(s_chs, s_num_chs);
+    s_backend = &spi_backend;
     return 0;
 }
 
 int LightSensor_ReadRaw(uint16_t *raw12) 
 {
-    return mcp3208_xfer(s_ch, raw12);
+    return LightSensor_ReadRawBatch(raw12, 1);
 }
 
 int LightSensor_ReadVolts(double *volts) 
 {
-    if (!volts) 
+    return LightSensor_ReadVoltsBatch(volts, 1);
+}
+
+int LightSensor_ReadRawBatch(uint16_t *raw12, int n) 
+{
+    if (!s_backend || !raw12 || n <= 0 || n > LIGHT_SENSOR_MAX_BATCH) 
+    {
+        errno = EINVAL; 
+        return -1;
+    }
+    return s_backend->read(&s_ch, 1, raw12, n);
+}
+
+int LightSensor_ReadVoltsBatch(double *volts, int n) 
+{
+    if (!volts || n <= 0 || n > LIGHT_SENSOR_MAX_BATCH) 
+    { 
+        errno = EINVAL; 
+        return -1; 
+    }
+    uint16_t r[LIGHT_SENSOR_MAX_BATCH];
+    int rc = LightSensor_ReadRawBatch(r, n);
+    if (rc < 0) 
+    {
+        return rc;
+    }
+    double scale = s_vref / 4096.0;
+    for (int i = 0; i < n; ++i) 
+    {
+        volts[i] = (double)r[i] * scale;
+    }
+    return 0;
+}
+
+int LightSensor_SetChannels(const int *channels, int num_channels)
+{
+    if (!s_backend || !channels || num_channels <= 0 || num_channels > LIGHT_SENSOR_MAX_CHANNELS) 
+    {
+        errno = EINVAL; 
+        return -1;
+    }
+    for (int i = 0; i < num_channels; ++i) 
+    {
+        if (channels[i] < 0 || channels[i] > 7) 
+        {
+            errno = EINVAL; 
+            return -1;
+        }
+        for (int j = 0; j < i; ++j) 
+        {
+            if (channels[j] == channels[i]) 
+            {
+                errno = EINVAL; 
+                return -1;
+            }
+        }
+    }
+    memcpy(s_chs, channels, (size_t)num_channels * sizeof(int));
+    s_num_chs = num_channels;
+    s_ch = channels[0];
+    return 0;
+}
+
+int LightSensor_GetChannels(int *channels, int max_channels)
+{
+    int n = s_num_chs < max_channels ? s_num_chs : max_channels;
+    for (int i = 0; channels && i < n; ++i) 
+    {
+        channels[i] = s_chs[i];
+    }
+    return s_num_chs;
+}
+
+int LightSensor_ReadRawScans(uint16_t *raw12, int scans) 
+{
+    if (!s_backend || !raw12 || scans <= 0 || scans > LIGHT_SENSOR_MAX_BATCH) 
+    {
+        errno = EINVAL; 
+        return -1;
+    }
+    return s_backend->read(s_chs, s_num_chs, raw12, scans);
+}
+
+int LightSensor_ReadVoltsScans(double *volts, int scans) 
+{
+    if (!volts || scans <= 0 || scans > LIGHT_SENSOR_MAX_BATCH) 
     { 
         errno = EINVAL; 
         return -1; 
     }
-    uint16_t r;
-    int rc = mcp3208_xfer(s_ch, &r);
+    uint16_t r[LIGHT_SENSOR_MAX_BATCH * LIGHT_SENSOR_MAX_CHANNELS];
+    int rc = LightSensor_ReadRawScans(r, scans);
     if (rc < 0) 
     {
         return rc;
     }
-    *volts = (double)r * (s_vref / 4096.0);
+    int n = scans * s_num_chs;
+    double scale = s_vref / 4096.0;
+    for (int i = 0; i < n; ++i) 
+    {
+        volts[i] = (double)r[i] * scale;
+    }
     return 0;
 }
 
@@ -117,6 +309,15 @@ int LightSensor_ReadVoltsAvg(int n, double *volts_avg)
     return 0;
 }
 
+double LightSensor_VoltsPerCode(void)
+{
+    return s_vref / 4096.0;
+}
+
 void LightSensor_Close(void) {
-    if (s_fd >= 0) { close(s_fd); s_fd = -1; }
+    if (s_backend) 
+    {
+        s_backend->close();
+        s_backend = NULL;
+    }
 }
@@ -0,0 +1,21 @@
+// light_sensor_backend.h
+// Internal to the HAL: the light sensor API dispatches every read to one
+// backend, chosen by LightSensor_Init().
+#ifndef LIGHT_SENSOR_BACKEND_H
+#define LIGHT_SENSOR_BACKEND_H
+
+#include <stdint.h>
+
+typedef struct {
+    // Read `scans` (1..LIGHT_SENSOR_MAX_BATCH) scans of the `num_ch`
+    // channels in `chs`, as 12-bit codes interleaved [scan][channel].
+    int  (*read)(const int *chs, int num_ch, uint16_t *out12, int scans);
+    void (*close)(void);
+} LightSensorBackend;
+
+// Simulated ADC (light_sensor_sim.c). `spec` is the text after the
+// LIGHT_SENSOR_SIM_PREFIX given to LightSensor_Init().
+extern const LightSensorBackend LightSensorSim_backend;
+int LightSensorSim_open(const char *spec, double vref_v);
+
+#endif
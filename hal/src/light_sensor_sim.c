@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+#include "hal/light_sensor.h"
+#include "light_sensor_backend.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Simulated MCP3208: produces the codes a light sensor would, indexed by
+// sample number (not wall time) so a run is fully deterministic.
+
+typedef struct {
+    double   dc;            // steady light level (V)
+    double   noise;         // peak uniform noise (V)
+    double   flicker_hz;    // PWM flicker frequency, 0 = none
+    double   flicker_depth; // level drop while the PWM is off (V)
+    double   duty;          // PWM on fraction 0..1
+    long     dip_every;     // inject a dip every N samples, 0 = none
+    long     dip_len;       // dip length (samples)
+    double   dip_depth;     // dip depth (V)
+    double   rate;          // samples per second the generator assumes
+    uint32_t seed;
+} sim_config_t;
+
+static sim_config_t s_cfg;
+static double   s_vref = 3.3;
+static uint64_t s_k    = 0;     // samples generated so far
+static uint32_t s_rng  = 1;
+
+// Replay mode: codes loaded from a file, played back in a loop.
+static uint16_t *s_replay   = NULL;
+static size_t    s_replay_n = 0;
+
+static uint16_t volts_to_code(double v)
+{
+    double c = v * 4096.0 / s_vref + 0.5;
+    if (c < 0.0) return 0;
+    if (c > 4095.0) return 4095;
+    return (uint16_t)c;
+}
+
+// Uniform in [-1, 1).
+static double rng_uniform(void)
+{
+    s_rng = s_rng * 1664525u + 1013904223u;
+    return (double)(s_rng >> 8) / (double)(1u << 23) - 1.0;
+}
+
+static double sim_level(uint64_t k)
+{
+    double v = s_cfg.dc;
+
+    if (s_cfg.flicker_hz > 0.0) 
+    {
+        double cycles = (double)k * s_cfg.flicker_hz / s_cfg.rate;
+        double phase  = cycles - (double)(uint64_t)cycles;
+        if (phase >= s_cfg.duty) 
+        {
+            v -= s_cfg.flicker_depth;
+        }
+    }
+    if (s_cfg.dip_every > 0 && (long)(k % (uint64_t)s_cfg.dip_every) < s_cfg.dip_len) 
+    {
+        v -= s_cfg.dip_depth;
+    }
+    if (s_cfg.noise > 0.0) 
+    {
+        v += s_cfg.noise * rng_uniform();
+    }
+    return v;
+}
+
+// Each channel sees the same pattern shifted by a few samples (so dips on
+// different channels do not line up) with its own noise.
+#define SIM_CHANNEL_SHIFT 97
+
+static int sim_read(const int *chs, int num_ch, uint16_t *out12, int scans)
+{
+    for (int i = 0; i < scans; ++i, ++s_k) 
+    {
+        for (int c = 0; c < num_ch; ++c)
+        {
+            uint16_t *out = &out12[i * num_ch + c];
+            uint64_t k = s_k + (uint64_t)chs[c] * SIM_CHANNEL_SHIFT;
+            if (s_replay_n > 0) 
+            {
+                *out = s_replay[k % s_replay_n];
+            }
+            else 
+            {
+                *out = volts_to_code(sim_level(k));
+            }
+        }
+    }
+    return 0;
+}
+
+static void sim_close(void)
+{
+    free(s_replay);
+    s_replay   = NULL;
+    s_replay_n = 0;
+}
+
+const LightSensorBackend LightSensorSim_backend = {
+    .read  = sim_read,
+    .close = sim_close,
+};
+
+// Load one value (volts) per line; the first comma-separated field is used
+// and lines starting with '#' are skipped.
+static int load_replay(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    size_t cap = 4096;
+    uint16_t *codes = malloc(cap * sizeof(uint16_t));
+    size_t n = 0;
+    char line[128];
+    while (codes && fgets(line, sizeof(line), f)) 
+    {
+        if (line[0] == '#') continue;
+
+        char *end = NULL;
+        double v = strtod(line, &end);
+        if (end == line) continue;
+
+        if (n == cap) 
+        {
+            uint16_t *grown = realloc(codes, cap * 2 * sizeof(uint16_t));
+            if (!grown) 
+            {
+                free(codes);
+                codes = NULL;
+                break;
+            }
+            codes = grown;
+            cap *= 2;
+        }
+        codes[n++] = volts_to_code(v);
+    }
+    fclose(f);
+
+    if (!codes || n == 0) 
+    {
+        free(codes);
+        errno = codes ? EINVAL : ENOMEM;
+        return -1;
+    }
+    s_replay   = codes;
+    s_replay_n = n;
+    return 0;
+}
+
+// Parse "key=value,key=value,...". Returns 0, or -1 on an unknown key.
+static int parse_spec(const char *spec, char *file, size_t file_len)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) 
+    {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        const char *key = tok;
+        const char *val = eq + 1;
+
+        if      (!strcmp(key, "dc"))            s_cfg.dc = atof(val);
+        else if (!strcmp(key, "noise"))         s_cfg.noise = atof(val);
+        else if (!strcmp(key, "flicker_hz"))    s_cfg.flicker_hz = atof(val);
+        else if (!strcmp(key, "flicker_depth")) s_cfg.flicker_depth = atof(val);
+        else if (!strcmp(key, "duty"))          s_cfg.duty = atof(val) / 100.0;
+        else if (!strcmp(key, "dip_every"))     s_cfg.dip_every = atol(val);
+        else if (!strcmp(key, "dip_len"))       s_cfg.dip_len = atol(val);
+        else if (!strcmp(key, "dip_depth"))     s_cfg.dip_depth = atof(val);
+        else if (!strcmp(key, "rate"))          s_cfg.rate = atof(val);
+        else if (!strcmp(key, "seed"))          s_cfg.seed = (uint32_t)strtoul(val, NULL, 0);
+        else if (!strcmp(key, "file"))          snprintf(file, file_len, "%s", val);
+        else return -1;
+    }
+    return 0;
+}
+
+int LightSensorSim_open(const char *spec, double vref_v)
+{
+    sim_close();
+
+    s_cfg = (sim_config_t){
+        .dc            = 1.5,
+        .noise         = 0.01,
+        .flicker_hz    = 0.0,
+        .flicker_depth = 0.5,
+        .duty          = 0.5,
+        .dip_every     = 0,
+        .dip_len       = 5,
+        .dip_depth     = 0.3,
+        .rate          = 1000.0,
+        .seed          = 1,
+    };
+
+    char file[256] = "";
+    if (parse_spec(spec ? spec : "", file, sizeof(file)) < 0 || s_cfg.rate <= 0.0) 
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    s_vref = vref_v;
+    s_k    = 0;
+    s_rng  = s_cfg.seed ? s_cfg.seed : 1;
+
+    if (file[0] && load_replay(file) < 0) 
+    {
+        return -1;
+    }
+    return 0;
+}